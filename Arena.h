@@ -0,0 +1,139 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <new>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#endif
+
+// Fixed Size Block Pool
+// Blocks are cache line aligned and carved from large chunks, so a pool of
+// instances packs into few pages and TLB entries instead of being spread
+// over the heap. Chunks can be backed by huge pages. Freed blocks are
+// reused; chunks are kept until the process exits.
+class Arena {
+public:
+	static const size_t Line = 64;
+
+private:
+	static const size_t HugePage = 2 << 20;
+
+	std::mutex lock;
+	size_t size;				// Block size, whole cache lines
+	size_t chunkBlocks;			// Blocks per chunk when the pool grows
+	bool huge = false;
+	uint8_t* next = nullptr;	// Unused space in the newest chunk
+	uint8_t* end = nullptr;
+	void* freeList = nullptr;	// Released blocks, linked through their first word
+	size_t used = 0;
+
+	static void* map(size_t bytes, bool hugePages) {
+#ifdef _WIN32
+		void* chunk = nullptr;
+		if (hugePages) chunk = VirtualAlloc(nullptr, bytes, MEM_RESERVE | MEM_COMMIT | MEM_LARGE_PAGES, PAGE_READWRITE);
+		if (!chunk) chunk = VirtualAlloc(nullptr, bytes, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+		return chunk;
+#else
+		void* chunk = MAP_FAILED;
+#ifdef MAP_HUGETLB
+		if (hugePages) chunk = mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+#endif
+		if (chunk == MAP_FAILED) {
+			// no reserved huge pages: ask for transparent ones instead
+			chunk = mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+			if (chunk == MAP_FAILED) return nullptr;
+#ifdef MADV_HUGEPAGE
+			if (hugePages) madvise(chunk, bytes, MADV_HUGEPAGE);
+#endif
+		}
+		return chunk;
+#endif
+	}
+	bool grow(size_t blocks) {
+		size_t bytes = blocks * size;
+		if (huge) bytes = (bytes + HugePage - 1) & ~(HugePage - 1);
+		uint8_t* chunk = (uint8_t*)map(bytes, huge);
+		if (!chunk) return false;
+		next = chunk;
+		end = chunk + bytes;
+		return true;
+	}
+
+public:
+	Arena(size_t blockSize, size_t blocksPerChunk) : size((blockSize + Line - 1) & ~(Line - 1)), chunkBlocks(blocksPerChunk) {}
+	Arena(const Arena&) = delete;
+	Arena& operator=(const Arena&) = delete;
+
+	// Pool Setup
+	void useHugePages(bool enable) {
+		// applies to chunks mapped from now on
+		std::lock_guard<std::mutex> guard(lock);
+		huge = enable;
+	}
+	bool reserve(size_t blocks) {
+		// maps room for blocks more in one chunk; unused space left in the
+		// previous chunk is given up
+		std::lock_guard<std::mutex> guard(lock);
+		return grow(blocks);
+	}
+
+	// Blocks
+	void* allocate() {
+		std::lock_guard<std::mutex> guard(lock);
+		void* block = freeList;
+		if (block) freeList = *(void**)block;
+		else {
+			if (end - next < (ptrdiff_t)size && !grow(chunkBlocks)) throw std::bad_alloc();
+			block = next;
+			next += size;
+		}
+		used++;
+		return block;
+	}
+	void release(void* block) {
+		std::lock_guard<std::mutex> guard(lock);
+		*(void**)block = freeList;
+		freeList = block;
+		used--;
+	}
+	size_t blockSize() {
+		return size;
+	}
+	size_t blocksInUse() {
+		std::lock_guard<std::mutex> guard(lock);
+		return used;
+	}
+};
+
+// Allocator for small bookkeeping objects (shared_ptr control blocks), one
+// cache line each from a shared pool; anything bigger goes to the heap.
+template <typename T>
+struct ArenaAllocator {
+	typedef T value_type;
+
+	static Arena& pool() {
+		static Arena* lines = new Arena(Arena::Line, 4096);
+		return *lines;
+	}
+
+	ArenaAllocator() {}
+	template <typename U> ArenaAllocator(const ArenaAllocator<U>&) {}
+
+	T* allocate(size_t n) {
+		if (n * sizeof(T) <= Arena::Line) return (T*)pool().allocate();
+		return (T*)::operator new(n * sizeof(T));
+	}
+	void deallocate(T* p, size_t n) {
+		if (n * sizeof(T) <= Arena::Line) pool().release(p);
+		else ::operator delete(p);
+	}
+	template <typename U> bool operator==(const ArenaAllocator<U>&) const { return true; }
+	template <typename U> bool operator!=(const ArenaAllocator<U>&) const { return false; }
+};
@@ -1,11 +1,19 @@
 #pragma once
 
 #include "MemMap.h"
+#include "Profiler.h"
 
 class CPU {
 	// Singleton Class
 	static CPU* instance;
-	CPU() {}
+	CPU() {
+		mem->setClock(&cycle);
+		mem->setLimit(&limit);
+	}
+	CPU(MemMap* bus, bool accurateBus = false) : mem(bus), accurate(accurateBus) {
+		mem->setClock(&cycle, accurate);
+		mem->setLimit(&limit);
+	}
 
 	// Memory Access
 	MemMap* mem = mem->getInstance();
@@ -23,6 +31,23 @@ private:
 	unsigned int cycle = 0;
 	bool extraCycle = false;
 
+	// Accuracy Tier
+	// Both cores are generated from the same instruction code. The fast core
+	// runs whole instructions and adds their cycles afterwards; the accurate
+	// core also issues the dummy reads and writes the 6502 makes, and counts
+	// each bus cycle as it happens so registers see the exact cycle of every
+	// access. Chosen per instance at construction.
+	bool accurate = false;
+	unsigned int busCycles = 0;	// Counted so far by the current accurate instruction
+
+	// Frame Timing
+	unsigned int frameEnd = 0;	// Cycle at which the current frame ends
+	unsigned int frameDots = 0;	// PPU dots left over from the last frame
+	unsigned int limit = 0;		// Run up to here: the frame end or the next event
+
+	// Profiling
+	Profiler* profiler = nullptr;	// Not owned; null when not profiling
+
 	// Helper Functions
 	enum flags {
 		Carry, Zero, Interrupt, Decimal, Break, unused, Overflow, Negative
@@ -37,70 +62,128 @@ private:
 	bool readFlag(int id) {
 		return (SF & 1 << id) != 0;
 	}
+
+	// Bus Access
+	template <bool Accurate>
+	void tick() {
+		if (Accurate) {
+			cycle++;
+			busCycles++;
+		}
+	}
+	template <bool Accurate>
+	void idle(uint16_t addr) {
+		// a cycle whose read is thrown away; only the test bus sees it
+		if (Accurate) mem->idle(addr);
+		tick<Accurate>();
+	}
+	template <bool Accurate>
+	uint8_t busRead(uint16_t addr) {
+		uint8_t value = mem->read(addr);
+		tick<Accurate>();
+		return value;
+	}
+	template <bool Accurate>
+	uint8_t busOperand(uint16_t addr) {
+		uint8_t value = mem->operand(addr);
+		tick<Accurate>();
+		return value;
+	}
+	template <bool Accurate>
+	uint8_t busFetch(uint16_t addr) {
+		uint8_t value = mem->fetch(addr);
+		tick<Accurate>();
+		return value;
+	}
+	template <bool Accurate>
+	void busWrite(uint16_t addr, uint8_t value) {
+		mem->write(addr, value);
+		tick<Accurate>();
+	}
+	template <bool Accurate>
+	void dummyRead(uint16_t base, uint16_t addr, bool write) {
+		// indexed modes read before the carry into the high byte is fixed;
+		// always for stores and read-modify-writes, on a page cross otherwise
+		if (Accurate && (write || (base ^ addr) & 0xFF00)) busRead<Accurate>((base & 0xFF00) | (addr & 0x00FF));
+	}
+	template <bool Accurate>
 	uint8_t readMem(uint8_t mode) {
-		uint16_t addr;
+		uint16_t addr = 0;
 		switch (mode) {
-		case 1: addr = abs(); break;
-		case 2: addr = abs_x(); break;
-		case 3: addr = abs_y(); break;
-		case 4: addr = imm(); break;
-		case 5: addr = ind(); break;
-		case 6: addr = x_ind(); break;
-		case 7: addr = ind_y(); break;
-		case 8: addr = zpg(); break;
-		case 9: addr = zpg_x(); break;
-		case 10: addr = zpg_y(); break;
+		case 1: addr = abs<Accurate>(); break;
+		case 2: addr = abs_x<Accurate>(); break;
+		case 3: addr = abs_y<Accurate>(); break;
+		case 4: return busOperand<Accurate>(imm());
+		case 5: addr = ind<Accurate>(); break;
+		case 6: addr = x_ind<Accurate>(); break;
+		case 7: addr = ind_y<Accurate>(); break;
+		case 8: addr = zpg<Accurate>(); break;
+		case 9: addr = zpg_x<Accurate>(); break;
+		case 10: addr = zpg_y<Accurate>(); break;
 		}
-		return mem->read(addr);
+		return busRead<Accurate>(addr);
 	}
-	void writeMem(uint8_t mode, uint8_t value) {
+	template <bool Accurate>
+	uint16_t writeAddress(uint8_t mode) {
+		// stores and read-modify-writes
 		uint16_t addr;
 		switch (mode) {
-		case 1: addr = abs(); break;
-		case 2: addr = abs_x(); break;
-		case 3: addr = abs_y(); break;
+		case 1: addr = abs<Accurate>(); break;
+		case 2: addr = abs_x<Accurate>(true); break;
+		case 3: addr = abs_y<Accurate>(true); break;
 			// case 4: addr = imm(); break;
-		case 5: addr = ind(); break;
-		case 6: addr = x_ind(); break;
-		case 7: addr = ind_y(); break;
-		case 8: addr = zpg(); break;
-		case 9: addr = zpg_x(); break;
-		case 10: addr = zpg_y(); break;
+		case 5: addr = ind<Accurate>(); break;
+		case 6: addr = x_ind<Accurate>(); break;
+		case 7: addr = ind_y<Accurate>(true); break;
+		case 8: addr = zpg<Accurate>(); break;
+		case 9: addr = zpg_x<Accurate>(); break;
+		case 10: addr = zpg_y<Accurate>(); break;
 		}
-		mem->write(addr, value);
+		return addr;
 	}
+	template <bool Accurate>
+	void writeMem(uint8_t mode, uint8_t value) {
+		busWrite<Accurate>(writeAddress<Accurate>(mode), value);
+	}
+	template <bool Accurate>
 	void push(uint8_t value) {
 		uint16_t addr = SP + 0x100;
-		mem->write(addr, value);
+		busWrite<Accurate>(addr, value);
 		SP--;
 	}
+	template <bool Accurate>
 	uint8_t pull() {
 		SP++;
 		uint16_t addr = SP + 0x100;
-		return mem->read(addr);
+		return busRead<Accurate>(addr);
 	}
 
 	// Address Modes
+	template <bool Accurate>
 	uint16_t abs() {
-		uint8_t ll = mem->read(PC + 1);
-		uint8_t hh = mem->read(PC + 2);
+		uint8_t ll = busOperand<Accurate>(PC + 1);
+		uint8_t hh = busOperand<Accurate>(PC + 2);
 		PC += 3;
 		return ll + (hh << 8);
 	}
-	uint16_t abs_x() {
-		uint8_t ll = mem->read(PC + 1);
-		uint8_t hh = mem->read(PC + 2);
+	template <bool Accurate>
+	uint16_t abs_x(bool write = false) {
+		uint8_t ll = busOperand<Accurate>(PC + 1);
+		uint8_t hh = busOperand<Accurate>(PC + 2);
 		uint16_t addr = ll + (hh << 8) + X;
+		dummyRead<Accurate>(ll + (hh << 8), addr, write);
 
 		// check if page boundary crossed
 		if ((addr >> 8) != (PC >> 8)) extraCycle++;
 		PC += 3;
 		return addr;
 	}
-	uint16_t abs_y() {
-		uint8_t ll = mem->read(PC + 1);
-		uint8_t hh = mem->read(PC + 2);
+	template <bool Accurate>
+	uint16_t abs_y(bool write = false) {
+		uint8_t ll = busOperand<Accurate>(PC + 1);
+		uint8_t hh = busOperand<Accurate>(PC + 2);
 		uint16_t addr = ll + (hh << 8) + Y;
+		dummyRead<Accurate>(ll + (hh << 8), addr, write);
 
 		// check if page boundary crossed
 		if ((addr >> 8) != (PC >> 8)) extraCycle++;
@@ -113,24 +196,30 @@ private:
 		PC += 2;
 		return addr;
 	}
+	template <bool Accurate>
 	uint16_t ind() {
-		uint16_t addr = abs();
-		uint8_t ll = mem->read(addr);
-		uint8_t hh = mem->read(addr + 1);
+		uint16_t addr = abs<Accurate>();
+		uint8_t ll = busRead<Accurate>(addr);
+		uint8_t hh = busRead<Accurate>(addr + 1);
 		return ll + (hh << 8);
 	}
+	template <bool Accurate>
 	uint16_t x_ind() {
-		uint8_t addr = mem->read(PC + 1) + X;
-		uint8_t ll = mem->read(addr);
-		uint8_t hh = mem->read(addr + 1);
+		uint8_t pointer = busOperand<Accurate>(PC + 1);
+		idle<Accurate>(pointer);	// reads the unindexed pointer
+		uint8_t addr = pointer + X;
+		uint8_t ll = busRead<Accurate>(addr);
+		uint8_t hh = busRead<Accurate>(addr + 1);
 		PC += 2;
 		return ll + (hh << 8);
 	}
-	uint16_t ind_y() {
-		uint16_t addr = mem->read(PC + 1);
-		uint8_t ll = mem->read(addr);
-		uint8_t hh = mem->read(addr + 1);
+	template <bool Accurate>
+	uint16_t ind_y(bool write = false) {
+		uint16_t addr = busOperand<Accurate>(PC + 1);
+		uint8_t ll = busRead<Accurate>(addr);
+		uint8_t hh = busRead<Accurate>(addr + 1);
 		addr = ll + (hh << 8) + Y;
+		dummyRead<Accurate>(ll + (hh << 8), addr, write);
 
 		// check if page boundary crossed
 		if ((addr >> 8) != (PC >> 8)) extraCycle++;
@@ -138,22 +227,30 @@ private:
 		PC += 2;
 		return addr;
 	}
+	template <bool Accurate>
 	uint16_t rel() {
-		int8_t offset = mem->read(PC + 1);
+		int8_t offset = busOperand<Accurate>(PC + 1);
 		return PC + offset;
 	}
+	template <bool Accurate>
 	uint8_t zpg() {
-		uint8_t addr = mem->read(PC + 1);
+		uint8_t addr = busOperand<Accurate>(PC + 1);
 		PC += 2;
 		return addr;
 	}
+	template <bool Accurate>
 	uint8_t zpg_x() {
-		uint8_t addr = mem->read(PC + 1) + X;
+		uint8_t addr = busOperand<Accurate>(PC + 1);
+		idle<Accurate>(addr);	// reads the unindexed address
+		addr += X;
 		PC += 2;
 		return addr;
 	}
+	template <bool Accurate>
 	uint8_t zpg_y() {
-		uint8_t addr = mem->read(PC + 1) + Y;
+		uint8_t addr = busOperand<Accurate>(PC + 1);
+		idle<Accurate>(addr);	// reads the unindexed address
+		addr += Y;
 		PC += 2;
 		return addr;
 	}
@@ -164,6 +261,23 @@ public:
 		if (!instance) instance = new CPU;
 		return instance;
 	}
+	static CPU* create(MemMap* bus) {
+		// independent CPU for parallel jobs
+		return new CPU(bus);
+	}
+	static CPU* create(MemMap* bus, void* where, bool accurate = false) {
+		// accurate selects the per bus cycle core (see Accuracy Tier)
+		return where ? new (where) CPU(bus, accurate) : new CPU(bus, accurate);
+	}
+	CPU* fork(MemMap* bus, void* where = nullptr) {
+		// same registers, running on a forked memory map
+		CPU* child = where ? new (where) CPU(*this) : new CPU(*this);
+		child->mem = bus;
+		child->profiler = nullptr;
+		bus->setClock(&child->cycle, child->accurate);
+		bus->setLimit(&child->limit);
+		return child;
+	}
 
 	// Emulator Utilities
 	void test() {
@@ -186,7 +300,7 @@ public:
 		mem->write(0x1CC, 0xAC);
 
 		std::cout << "\n  Absolute mode: ";{
-			value = abs();
+			value = abs<false>();
 			if (value == 0xABCD) std::cout << "OK";
 			else {
 				printf("Error: Expected abcd, got %0004x", value);
@@ -195,7 +309,7 @@ public:
 		}
 		PC = 0;
 		std::cout << "\n  Absolute, X Indexed mode: ";{
-			value = abs_x();
+			value = abs_x<false>();
 			if (value == 0xACBC) std::cout << "OK";
 			else {
 				printf("Error: Expected acbc, got %0004x", value);
@@ -204,7 +318,7 @@ public:
 		}
 		PC = 0;
 		std::cout << "\n  Absolute, Y Indexed mode: ";{
-			value = abs_y();
+			value = abs_y<false>();
 			if (value == 0xACCB) std::cout << "OK";
 			else {
 				printf("Error: Expected accb, got %0004x", value);
@@ -222,7 +336,7 @@ public:
 		}
 		PC = 0;
 		std::cout << "\n  Indirect mode: ";{
-			value = ind();
+			value = ind<false>();
 			if (value == 0xFACE) std::cout << "OK";
 			else {
 				printf("Error: Expected face, got %0004x", value);
@@ -233,7 +347,7 @@ public:
 		std::cout << "\n  X, Indirect mode: ";{
 			X = 0xAB;
 
-			value = x_ind();
+			value = x_ind<false>();
 			if (value == 0xFADE) std::cout << "OK";
 			else {
 				printf("Error: Expected fade, got %0004x", value);
@@ -242,7 +356,7 @@ public:
 		}
 		PC = 0;
 		std::cout << "\n  Indirect, Y mode: ";{
-			value = ind_y();
+			value = ind_y<false>();
 			if (value == 0xCECB) std::cout << "OK";
 			else {
 				printf("Error: Expected cecb, got %0004x", value);
@@ -251,7 +365,7 @@ public:
 		}
 		PC = 0;
 		std::cout << "\n  Relative mode: ";{
-			value = rel();
+			value = rel<false>();
 			if (value == 0xFFCD) std::cout << "OK";
 			else {
 				printf("Error: Expected ffed, got %0004x", value);
@@ -260,7 +374,7 @@ public:
 		}
 		PC = 0;
 		std::cout << "\n  Zero Page mode: ";{
-			value = zpg();
+			value = zpg<false>();
 			if (value == 0x00CD) std::cout << "OK";
 			else {
 				printf("Error: Expected 00cd, got %0004x", value);
@@ -269,7 +383,7 @@ public:
 		}
 		PC = 0;
 		std::cout << "\n  Zero Page, X mode: ";{
-			value = zpg_x();
+			value = zpg_x<false>();
 			if (value == 0x0078) std::cout << "OK";
 			else {
 				printf("Error: Expected 0078, got %0004x", value);
@@ -278,7 +392,7 @@ public:
 		}
 		PC = 0;
 		std::cout << "\n  Zero Page, Y mode: ";{
-			value = zpg_y();
+			value = zpg_y<false>();
 			if (value == 0x00CB) std::cout << "OK";
 			else {
 				printf("Error: Expected 00cb, got %0004x", value);
@@ -286,6 +400,108 @@ public:
 			}
 		}
 		PC = 0;
+		std::cout << "\n  Accurate bus: ";{
+			// LDX #$01; LDY $02FF,X; INC $0300,X; LDA #$04; STA $4014 (DMA on an odd cycle)
+			static const uint8_t program[] = { 0xA2, 0x01, 0xBC, 0xFF, 0x02, 0xFE, 0x00, 0x03, 0xA9, 0x04, 0x8D, 0x14, 0x40 };
+			int reads[2], writes[2];
+			unsigned int cycles[2];
+			for (int tier = 0; tier < 2; tier++) {
+				MemMap* bus = MemMap::create();
+				CPU* core = new CPU(bus, tier == 1);
+				for (int i = 0; i < (int)sizeof(program); i++) bus->write(0x8000 + i, program[i]);
+				bus->addWatch(0x0200, 0x0200, WatchRead);		// LDY before the carry
+				bus->addWatch(0x0301, 0x0301, WatchWrite);		// INC writes twice
+				core->PC = 0x8000;
+				for (int i = 0; i < 5; i++) core->execute();
+				reads[tier] = writes[tier] = 0;
+				for (const WatchHit& hit : bus->watchHits()) (hit.type == WatchRead ? reads : writes)[tier]++;
+				cycles[tier] = core->cycle;
+				delete core;
+				delete bus;
+			}
+			if (reads[0] == 0 && writes[0] == 1 && reads[1] == 1 && writes[1] == 2 && cycles[0] == cycles[1]) std::cout << "OK";
+			else {
+				printf("Error: dummy accesses %d/%d reads, %d/%d writes, %u/%u cycles", reads[0], reads[1], writes[0], writes[1], cycles[0], cycles[1]);
+				err_cnt++;
+			}
+		}
+		std::cout << "\n  State hash: ";{
+			// every register lands in its own bits, X >= $80 included
+			MemMap* bus = MemMap::create();
+			CPU* core[2] = { new CPU(bus), new CPU(bus) };
+			for (CPU* c : core) c->X = 0x80;
+			core[1]->Y = 0x01;
+			bool y = core[0]->hash() != core[1]->hash();
+			core[1]->Y = 0x00;
+			core[1]->SF = 0x21;
+			bool sf = core[0]->hash() != core[1]->hash();
+			core[1]->SF = core[0]->SF;
+			core[1]->SP = 0xFE;
+			bool sp = core[0]->hash() != core[1]->hash();
+			delete core[0];
+			delete core[1];
+			delete bus;
+			if (y && sf && sp) std::cout << "OK";
+			else {
+				std::cout << "Error: registers missing from the hash";
+				err_cnt++;
+			}
+		}
+		std::cout << "\n  Interrupts: ";{
+			// STX $2000 (NMI on in VBlank); CLI with the DMC holding IRQ
+			static const uint8_t program[] = { 0x8E, 0x00, 0x20, 0x58, 0xEA };
+			MemMap* bus = MemMap::create();
+			CPU* core = new CPU(bus);
+			for (int i = 0; i < (int)sizeof(program); i++) bus->write(0x8000 + i, program[i]);
+			bus->write(0xFFFA, 0x00);
+			bus->write(0xFFFB, 0x90);
+			bus->write(0xFFFE, 0x00);
+			bus->write(0xFFFF, 0x91);
+			bus->beginFrame();
+			core->PC = 0x8000;
+			core->X = 0x80;
+			core->setFlag(Interrupt);
+			core->execute();
+			bool nmi = core->PC == 0x9000 && bus->read(0x01FF) == 0x80 && bus->read(0x01FE) == 0x03 && core->cycle == 4 + 7;
+
+			bus->write(0x4010, 0x80);	// IRQ at the end of a 1 byte sample
+			bus->write(0x4013, 0x00);
+			bus->write(0x4015, 0x10);
+			core->PC = 0x8003;
+			core->execute();
+			bool irq = core->PC == 0x9100 && bus->read(0x01FC) == 0x80 && bus->read(0x01FB) == 0x04 && core->readFlag(Interrupt);
+			delete core;
+			delete bus;
+			if (nmi && irq) std::cout << "OK";
+			else {
+				std::cout << "Error: interrupt taken at the wrong point or with the wrong return address";
+				err_cnt++;
+			}
+		}
+		std::cout << "\n  Profiled interrupt: ";{
+			// STX $2000 takes the NMI; its 4 cycles stay with the caller
+			static const uint8_t program[] = { 0x8E, 0x00, 0x20 };
+			MemMap* bus = MemMap::create();
+			CPU* core = new CPU(bus);
+			Profiler profile;
+			for (int i = 0; i < (int)sizeof(program); i++) bus->write(0x8000 + i, program[i]);
+			bus->write(0xFFFA, 0x00);
+			bus->write(0xFFFB, 0x90);
+			bus->beginFrame();
+			core->setProfiler(&profile);
+			core->PC = 0x8000;
+			core->X = 0x80;
+			core->executeProfiled();
+			std::ostringstream collapsed;
+			profile.collapsed(collapsed);
+			delete core;
+			delete bus;
+			if (collapsed.str() == "main 4\nmain;nmi $9000 7\n") std::cout << "OK";
+			else {
+				std::cout << "Error: cycles charged to the wrong routine";
+				err_cnt++;
+			}
+		}
 
 		if (err_cnt == 0) std::cout << "\nCPU OK\n";
 		else printf("\nCPU NOT OK: %d errors found\n", err_cnt);
@@ -299,9 +515,123 @@ public:
 			std::cout << readFlag(i);
 		}
 	}
+	unsigned int* clock() {
+		// DMA stalls are charged here
+		return &cycle;
+	}
 	void zeroPC() {
 		PC = 0;
 	}
+	void setProfiler(Profiler* recorder) {
+		// takes effect from the next frame run; pass null to stop
+		profiler = recorder;
+	}
+	bool isAccurate() {
+		return accurate;
+	}
+	unsigned int getCycle() {
+		return cycle;
+	}
+	void saveState(State& state) {
+		state.PC = PC;
+		state.ACC = ACC;
+		state.X = X;
+		state.Y = Y;
+		state.SF = SF;
+		state.SP = SP;
+		state.cycle = cycle;
+		state.frameEnd = frameEnd;
+		state.frameDots = frameDots;
+	}
+	void loadState(const State& state) {
+		PC = state.PC;
+		ACC = state.ACC;
+		X = state.X;
+		Y = state.Y;
+		SF = state.SF;
+		SP = state.SP;
+		cycle = state.cycle;
+		frameEnd = state.frameEnd;
+		frameDots = state.frameDots;
+		limit = cycle;	// events are found again at the next instruction
+	}
+	bool sameState(const CPU& other) {
+		return PC == other.PC && ACC == other.ACC && X == other.X && Y == other.Y && SF == other.SF && SP == other.SP &&
+			cycle == other.cycle && frameEnd == other.frameEnd && frameDots == other.frameDots;
+	}
+	uint64_t hash(uint64_t h = hashSeed) {
+		uint64_t regs = (uint64_t)PC | ((uint64_t)ACC << 16) | ((uint64_t)X << 24) | ((uint64_t)Y << 32) | ((uint64_t)SF << 40) | ((uint64_t)SP << 48);
+		h = hashMix(h, regs);
+		return hashMix(h, cycle);
+	}
+	uint64_t stateHash(uint64_t h = hashSeed) {
+		// hash() plus frame timing
+		return hashMix(hash(h), frameEnd | (uint64_t)frameDots << 32);
+	}
+
+	// Run one NTSC frame: 341 dots x 262 scanlines, 3 dots per CPU cycle
+	// Instructions run back to back up to the limit; nothing else is
+	// checked until then.
+	void runFrame() {
+		beginFrame();
+		while (!frameDone()) {
+			if (profiler) {
+				while (beforeLimit()) executeProfiled();
+			}
+			else if (accurate) {
+				while (beforeLimit()) step<true>();
+			}
+			else while (beforeLimit()) step<false>();
+			runEvents();
+		}
+	}
+	bool runFrameDebug() {
+		// same as runFrame, but stops after any instruction that triggers a
+		// watchpoint; call again to resume the frame
+		if (frameDone()) beginFrame();
+		while (!frameDone()) {
+			if (profiler) executeProfiled();
+			else execute();
+			if (!mem->watchHits().empty()) return true;
+		}
+		return false;
+	}
+	void beginFrame() {
+		mem->beginFrame();
+		frameDots += 89342;
+		frameEnd += frameDots / 3;
+		frameDots %= 3;
+		runEvents();
+	}
+	bool frameDone() {
+		return (int)(frameEnd - cycle) <= 0;
+	}
+	bool beforeLimit() {
+		return (int)(limit - cycle) > 0;
+	}
+	void unmasked() {
+		// I may have just cleared with IRQ held: stop after this instruction
+		if (mem->irqLines()) limit = cycle;
+	}
+	void runEvents() {
+		// due sources catch up and interrupts are polled, then run to the
+		// next event or the frame end
+		mem->runEvents();
+		unsigned int start = cycle;
+		if (mem->takeNMI()) {
+			if (accurate) serviceNMI<true>();
+			else serviceNMI<false>();
+		}
+		else if (mem->irqLines() && !readFlag(Interrupt)) {
+			if (accurate) serviceIRQ<true>();
+			else serviceIRQ<false>();
+		}
+		if (profiler) profiler->charge(cycle - start);	// entry cycles belong to the handler
+		limit = mem->nextEvent(frameEnd);
+	}
+	unsigned int runLimit() {
+		return limit;
+	}
 
 	int illegal_opcodes = 0;
 
@@ -311,8 +641,9 @@ public:
 	};
 
 	// Transfer Instructions
+	template <bool Accurate>
 	void LDA(uint8_t mode) {
-		uint8_t value = readMem(mode);
+		uint8_t value = readMem<Accurate>(mode);
 		ACC = value;
 
 		// Set affected flags
@@ -321,8 +652,9 @@ public:
 		if (value & 0x80) setFlag(Negative);
 		else clearFlag(Negative);
 	}
+	template <bool Accurate>
 	void LDX(uint8_t mode) {
-		uint8_t value = readMem(mode);
+		uint8_t value = readMem<Accurate>(mode);
 		X = value;
 
 		// Set affected flags
@@ -331,8 +663,9 @@ public:
 		if (value & 0x80) setFlag(Negative);
 		else clearFlag(Negative);
 	}
+	template <bool Accurate>
 	void LDY(uint8_t mode) {
-		uint8_t value = readMem(mode);
+		uint8_t value = readMem<Accurate>(mode);
 		Y = value;
 
 		// Set affected flags
@@ -341,17 +674,20 @@ public:
 		if (value & 0x80) setFlag(Negative);
 		else clearFlag(Negative);
 	}
+	template <bool Accurate>
 	void STA(uint8_t mode) {
 		uint8_t value = ACC;
-		writeMem(mode, value);
+		writeMem<Accurate>(mode, value);
 	}
+	template <bool Accurate>
 	void STX(uint8_t mode) {
 		uint8_t value = X;
-		writeMem(mode, value);
+		writeMem<Accurate>(mode, value);
 	}
+	template <bool Accurate>
 	void STY(uint8_t mode) {
 		uint8_t value = Y;
-		writeMem(mode, value);
+		writeMem<Accurate>(mode, value);
 	}
 	void TAX() {
 		X = ACC;
@@ -414,17 +750,21 @@ public:
 	}
 
 	// Stack Instructions
+	template <bool Accurate>
 	void PHA() {
-		push(ACC);
+		push<Accurate>(ACC);
 		PC++;
 	}
+	template <bool Accurate>
 	void PHP() {
 		setFlag(Break);
-		push(SF);
+		push<Accurate>(SF);
 		PC ++;
 	}
+	template <bool Accurate>
 	void PLA() {
-		ACC = pull();
+		idle<Accurate>(SP + 0x100);	// stack pointer increments
+		ACC = pull<Accurate>();
 
 		// Set affected flags
 		if (X == 0) setFlag(Zero);
@@ -434,18 +774,22 @@ public:
 
 		PC ++;
 	}
+	template <bool Accurate>
 	void PLP() {
-		SF = pull();
+		idle<Accurate>(SP + 0x100);	// stack pointer increments
+		SF = pull<Accurate>();
 		PC ++;
+		unmasked();
 	}
 
 	// Increments and Decrements
+	template <bool Accurate>
 	void DEC(uint8_t mode) {
-		uint16_t oldPC = PC;
-		uint8_t value = readMem(mode);
+		uint16_t addr = writeAddress<Accurate>(mode);
+		uint8_t value = busRead<Accurate>(addr);
+		if (Accurate) busWrite<Accurate>(addr, value);	// writes the unmodified value first
 		value--;
-		PC = oldPC;
-		writeMem(mode, value);
+		busWrite<Accurate>(addr, value);
 
 		// Set affected flags
 		if (value == 0) setFlag(Zero);
@@ -475,12 +819,13 @@ public:
 
 		PC ++;
 	}
+	template <bool Accurate>
 	void INC(uint8_t mode) {
-		uint16_t oldPC = PC;
-		uint8_t value = readMem(mode);
+		uint16_t addr = writeAddress<Accurate>(mode);
+		uint8_t value = busRead<Accurate>(addr);
+		if (Accurate) busWrite<Accurate>(addr, value);	// writes the unmodified value first
 		value++;
-		PC = oldPC;
-		writeMem(mode, value);
+		busWrite<Accurate>(addr, value);
 
 		// Set affected flags
 		if (value == 0) setFlag(Zero);
@@ -512,8 +857,9 @@ public:
 	}
 
 	// Arithmetic Operations
+	template <bool Accurate>
 	void ADC(uint8_t mode) {
-		int value = ACC + readMem(mode) + readFlag(Carry);
+		int value = ACC + readMem<Accurate>(mode) + readFlag(Carry);
 		ACC = value;
 
 		// Set Affected Flags
@@ -526,8 +872,9 @@ public:
 		if (value & 0x80) setFlag(Negative);
 		else clearFlag(Negative);
 	}
+	template <bool Accurate>
 	void SBC(uint8_t mode) {
-		int value = ACC - readMem(mode) - !readFlag(Carry);
+		int value = ACC - readMem<Accurate>(mode) - !readFlag(Carry);
 		ACC = value;
 
 		if (value < 0) clearFlag(Carry);
@@ -541,8 +888,9 @@ public:
 	}
 
 	// Logical Operations
+	template <bool Accurate>
 	void AND(uint8_t mode) {
-		uint8_t value = ACC & readMem(mode);
+		uint8_t value = ACC & readMem<Accurate>(mode);
 		ACC = value;
 
 		// Set affected flags
@@ -551,8 +899,9 @@ public:
 		if (value & 0x80) setFlag(Negative);
 		else clearFlag(Negative);
 	}
+	template <bool Accurate>
 	void EOR(uint8_t mode) {
-		uint8_t value = ACC ^ readMem(mode);
+		uint8_t value = ACC ^ readMem<Accurate>(mode);
 		ACC = value;
 
 		// Set affected flags
@@ -561,8 +910,9 @@ public:
 		if (value & 0x80) setFlag(Negative);
 		else clearFlag(Negative);
 	}
+	template <bool Accurate>
 	void ORA(uint8_t mode) {
-		uint8_t value = ACC | readMem(mode);
+		uint8_t value = ACC | readMem<Accurate>(mode);
 		ACC = value;
 
 		// Set affected flags
@@ -627,16 +977,17 @@ public:
 
 		PC ++;
 	}
+	template <bool Accurate>
 	void ASL(uint8_t mode) {
-		uint16_t oldPC = PC;
-		uint8_t value = readMem(mode);
+		uint16_t addr = writeAddress<Accurate>(mode);
+		uint8_t value = busRead<Accurate>(addr);
+		if (Accurate) busWrite<Accurate>(addr, value);	// writes the unmodified value first
 
 		if (value & 0x80) setFlag(Carry);
 		else clearFlag(Carry);
 		value = value << 1;
 
-		PC = oldPC;
-		writeMem(mode, value);
+		busWrite<Accurate>(addr, value);
 
 		// Set Flags
 		if (value == 0) setFlag(Zero);
@@ -644,16 +995,17 @@ public:
 		if (value & 0x80) setFlag(Negative);
 		else clearFlag(Negative);
 	}
+	template <bool Accurate>
 	void LSR(uint8_t mode) {
-		uint16_t oldPC = PC;
-		uint8_t value = readMem(mode);
+		uint16_t addr = writeAddress<Accurate>(mode);
+		uint8_t value = busRead<Accurate>(addr);
+		if (Accurate) busWrite<Accurate>(addr, value);	// writes the unmodified value first
 
 		if (value & 0x01) setFlag(Carry);
 		else clearFlag(Carry);
 		value = value >> 1;
 
-		PC = oldPC;
-		writeMem(mode, value);
+		busWrite<Accurate>(addr, value);
 
 		// Set Flags
 		if (value == 0) setFlag(Zero);
@@ -661,17 +1013,18 @@ public:
 		if (value & 0x80) setFlag(Negative);
 		else clearFlag(Negative);
 	}
+	template <bool Accurate>
 	void ROL(uint8_t mode) {
-		uint16_t oldPC = PC;
-		uint8_t value = readMem(mode);
+		uint16_t addr = writeAddress<Accurate>(mode);
+		uint8_t value = busRead<Accurate>(addr);
+		if (Accurate) busWrite<Accurate>(addr, value);	// writes the unmodified value first
 
 		if (value & 0x80) setFlag(Carry);
 		else clearFlag(Carry);
 		bool shiftIn = readFlag(Carry);
 		value = (value << 1) + shiftIn;
 
-		PC = oldPC;
-		writeMem(mode, value);
+		busWrite<Accurate>(addr, value);
 
 		// Set Flags
 		if (value == 0) setFlag(Zero);
@@ -679,17 +1032,18 @@ public:
 		if (value & 0x80) setFlag(Negative);
 		else clearFlag(Negative);
 	}
+	template <bool Accurate>
 	void ROR(uint8_t mode) {
-		uint16_t oldPC = PC;
-		uint8_t value = readMem(mode);
+		uint16_t addr = writeAddress<Accurate>(mode);
+		uint8_t value = busRead<Accurate>(addr);
+		if (Accurate) busWrite<Accurate>(addr, value);	// writes the unmodified value first
 
 		if (value & 0x01) setFlag(Carry);
 		else clearFlag(Carry);
 		bool shiftIn = readFlag(Carry);
 		value = (value >> 1) + (shiftIn << 7);
 
-		PC = oldPC;
-		writeMem(mode, value);
+		busWrite<Accurate>(addr, value);
 
 		// Set Flags
 		if (value == 0) setFlag(Zero);
@@ -710,6 +1064,7 @@ public:
 	void CLI() {
 		clearFlag(Interrupt);
 		PC ++;
+		unmasked();
 	}
 	void CLV() {
 		clearFlag(Overflow);
@@ -729,8 +1084,9 @@ public:
 	}
 
 	// Comparisons
+	template <bool Accurate>
 	void CMP(uint8_t mode) {
-		uint8_t value = readMem(mode);
+		uint8_t value = readMem<Accurate>(mode);
 
 		if (ACC == value) {
 			setFlag(Zero);
@@ -748,8 +1104,9 @@ public:
 			clearFlag(Negative);
 		}
 	}
+	template <bool Accurate>
 	void CPX(uint8_t mode) {
-		uint8_t value = readMem(mode);
+		uint8_t value = readMem<Accurate>(mode);
 
 		if (Y == value) {
 			setFlag(Zero);
@@ -767,8 +1124,9 @@ public:
 			clearFlag(Negative);
 		}
 	}
+	template <bool Accurate>
 	void CPY(uint8_t mode) {
-		uint8_t value = readMem(mode);
+		uint8_t value = readMem<Accurate>(mode);
 
 		if (Y == value) {
 			setFlag(Zero);
@@ -788,91 +1146,87 @@ public:
 	}
 
 	// Conditional Branches
+	template <bool Accurate>
+	void taken(int8_t offset) {
+		// reads the next opcode, then the wrong page when crossing
+		uint16_t next = PC + 2;
+		bool crossed = (PC & 0x00FF) + offset > 0xFF || (PC & 0x00FF) + offset < 0;
+		if (Accurate) {
+			mem->idle(next);
+			if (crossed) mem->idle((next & 0xFF00) | ((next + offset) & 0x00FF));
+		}
+		cycle += crossed ? 2 : 1;
+		PC += offset;
+	}
+	template <bool Accurate>
 	void BCC() {
 		uint16_t oldPC = PC;
-		int8_t offset = mem->read(PC + 1);
+		int8_t offset = busOperand<Accurate>(PC + 1);
 		if (!readFlag(Carry)) {
-			if ((PC & 0x00FF) + offset > 0xFF || (PC & 0x00FF) + offset < 0) cycle += 2;
-			else cycle++;
-
-			PC += offset;
+			taken<Accurate>(offset);
 		}
 		PC += 2;
 	}
+	template <bool Accurate>
 	void BCS() {
 		uint16_t oldPC = PC;
-		int8_t offset = mem->read(PC + 1);
+		int8_t offset = busOperand<Accurate>(PC + 1);
 		if (readFlag(Carry)) {
-			if ((PC & 0x00FF) + offset > 0xFF || (PC & 0x00FF) + offset < 0) cycle += 2;
-			else cycle++;
-
-			PC += offset;
+			taken<Accurate>(offset);
 		}
 		PC += 2;
 	}
+	template <bool Accurate>
 	void BEQ() {
 		uint16_t oldPC = PC;
-		int8_t offset = mem->read(PC + 1);
+		int8_t offset = busOperand<Accurate>(PC + 1);
 		if (readFlag(Zero)) {
-			if ((PC & 0x00FF) + offset > 0xFF || (PC & 0x00FF) + offset < 0) cycle += 2;
-			else cycle++;
-
-			PC += offset;
+			taken<Accurate>(offset);
 		}
 		PC += 2;
 	}
+	template <bool Accurate>
 	void BMI() {
 		uint16_t oldPC = PC;
-		int8_t offset = mem->read(PC + 1);
+		int8_t offset = busOperand<Accurate>(PC + 1);
 		if (readFlag(Negative)) {
-			if ((PC & 0x00FF) + offset > 0xFF || (PC & 0x00FF) + offset < 0) cycle += 2;
-			else cycle++;
-
-			PC += offset;
+			taken<Accurate>(offset);
 		}
 		PC += 2;
 	}
+	template <bool Accurate>
 	void BNE() {
 		uint16_t oldPC = PC;
-		int8_t offset = mem->read(PC + 1);
+		int8_t offset = busOperand<Accurate>(PC + 1);
 		if (!readFlag(Zero)) {
-			if ((PC & 0x00FF) + offset > 0xFF || (PC & 0x00FF) + offset < 0) cycle += 2;
-			else cycle++;
-
-			PC += offset;
+			taken<Accurate>(offset);
 		}
 		PC += 2;
 	}
+	template <bool Accurate>
 	void BPL() {
 		uint16_t oldPC = PC;
-		int8_t offset = mem->read(PC + 1);
+		int8_t offset = busOperand<Accurate>(PC + 1);
 		if (!readFlag(Negative)) {
-			if ((PC & 0x00FF) + offset > 0xFF || (PC & 0x00FF) + offset < 0) cycle += 2;
-			else cycle++;
-
-			PC += offset;
+			taken<Accurate>(offset);
 		}
 		PC += 2;
 	}
+	template <bool Accurate>
 	void BVC() {
 		uint16_t oldPC = PC;
-		int8_t offset = mem->read(PC + 1);
+		int8_t offset = busOperand<Accurate>(PC + 1);
 		if (!readFlag(Overflow)) {
-			if ((PC & 0x00FF) + offset > 0xFF || (PC & 0x00FF) + offset < 0) cycle += 2;
-			else cycle++;
-
-			PC += offset;
+			taken<Accurate>(offset);
 		}
 		PC += 2;
 	}
+	template <bool Accurate>
 	void BVS() {
 		uint16_t oldPC = PC;
-		int8_t offset = mem->read(PC + 1);
+		int8_t offset = busOperand<Accurate>(PC + 1);
 		if (readFlag(Overflow)) {
-			if ((PC & 0x00FF) + offset > 0xFF || (PC & 0x00FF) + offset < 0) cycle += 2;
-			else cycle++;
-
-			PC += offset;
+			taken<Accurate>(offset);
 		}
 		PC += 2;
 
@@ -880,41 +1234,59 @@ public:
 	}
 
 	// Jumps
+	template <bool Accurate>
 	void JMP(uint8_t mode) {
 		uint16_t addr;
-		if (mode == absM) addr = abs();
-		if (mode == indM) addr = ind();
+		if (mode == absM) addr = abs<Accurate>();
+		if (mode == indM) addr = ind<Accurate>();
 		PC = addr;
 	}
-	void JSR(uint8_t mode) {
-		push(PC >> 8);
-		push(PC);
-		JMP(mode);
-	}
+	template <bool Accurate>
+	void JSR(uint8_t) {
+		// the high address byte is fetched after the pushes
+		uint8_t ll = busOperand<Accurate>(PC + 1);
+		idle<Accurate>(SP + 0x100);
+		push<Accurate>(PC >> 8);
+		push<Accurate>(PC);
+		uint8_t hh = busOperand<Accurate>(PC + 2);
+		PC = ll + (hh << 8);
+		if (profiler) profiler->call(PC, mem->bank(PC), SP + 2);
+	}
+	template <bool Accurate>
 	void RTS() {
+		idle<Accurate>(SP + 0x100);	// stack pointer increments
 		// pull return address from stack
-		PC = pull() + (pull() << 8);
+		PC = pull<Accurate>() + (pull<Accurate>() << 8);
+		idle<Accurate>(PC);	// reads the return address before stepping past it
+		if (profiler) profiler->ret(SP);
 	}
 
 	// Interrupts (software)
+	template <bool Accurate>
 	void BRK() {
 		setFlag(Interrupt);
 		setFlag(Break);
 		PC += 2;
-		push(PC >> 8);
-		push(PC);
-		push(SF);
+		push<Accurate>(PC >> 8);
+		push<Accurate>(PC);
+		push<Accurate>(SF);
 
-		PC = mem->read(0xFFFA) + (mem->read(0xFFFB) << 8);
+		PC = busRead<Accurate>(0xFFFA) + (busRead<Accurate>(0xFFFB) << 8);
+		if (profiler) profiler->call(PC, mem->bank(PC), SP + 3, Profiler::Break);
 	}
+	template <bool Accurate>
 	void RTI() {
-		SF = pull() & 0xCF; // ignore break and unused flags
-		PC = pull() + (pull() << 8);
+		idle<Accurate>(SP + 0x100);	// stack pointer increments
+		SF = pull<Accurate>() & 0xCF; // ignore break and unused flags
+		PC = pull<Accurate>() + (pull<Accurate>() << 8);
+		if (profiler) profiler->ret(SP);
+		unmasked();
 	}
 
 	// Miscellaneous
+	template <bool Accurate>
 	void BIT(uint8_t mode) {
-		uint8_t value = readMem(mode);
+		uint8_t value = readMem<Accurate>(mode);
 		SF = SF | (value & 0b11000000);
 		if ((value & ACC) == 0) clearFlag(Zero);
 		else setFlag(Zero);
@@ -931,108 +1303,144 @@ public:
 		SP = 0xFD;
 
 		cycle = 7;
+		frameEnd = cycle;
+		frameDots = 0;
+		limit = cycle;
 		PC = mem->read(0xFFFC) + (mem->read(0xFFFD) << 8);
 	}
-	void irq() {
-		clearFlag(Break);
+	void softReset() {
+		// reset button: the clock keeps running through an interrupt
+		// sequence whose 3 pushes are reads
+		setFlag(Interrupt);
+		SP -= 3;
 		cycle += 7;
+		mem->reset();
+		PC = mem->read(0xFFFC) + (mem->read(0xFFFD) << 8);
+	}
+	// Interrupts are taken between instructions (see runEvents) and push
+	// the address of the next instruction
+	template <bool Accurate>
+	void serviceIRQ() {
+		clearFlag(Break);
 
 		if (!readFlag(Interrupt)) {
-			PC += 2;
-			push(PC >> 8);
-			push(PC);
-			push(SF);
-			PC = mem->read(0xFFFE) + (mem->read(0xFFFF) << 8);
+			push<Accurate>(PC >> 8);
+			push<Accurate>(PC);
+			push<Accurate>(SF);
+			PC = busRead<Accurate>(0xFFFE) + (busRead<Accurate>(0xFFFF) << 8);
 			setFlag(Interrupt);
+			if (profiler) profiler->call(PC, mem->bank(PC), SP + 3, Profiler::IRQ);
+			cycle += 7;
 		}
+		if (Accurate) cycle -= busCycles;
+		busCycles = 0;
 	}
-	void nmi() {
+	template <bool Accurate>
+	void serviceNMI() {
+		clearFlag(Break);
+		push<Accurate>(PC >> 8);
+		push<Accurate>(PC);
+		push<Accurate>(SF);
 		setFlag(Interrupt);
-		PC += 2;
-		push(PC >> 8);
-		push(PC);
-		push(SF);
-
-		PC = mem->read(0xFFFA) + (mem->read(0xFFFB) << 8);
 
+		PC = busRead<Accurate>(0xFFFA) + (busRead<Accurate>(0xFFFB) << 8);
+		if (profiler) profiler->call(PC, mem->bank(PC), SP + 3, Profiler::NMI);
+		if (Accurate) cycle -= busCycles;
+		busCycles = 0;
+		cycle += 7;
 	}
 
 	void execute() {
-		uint8_t opcode = mem->read(PC);
+		if (accurate) step<true>();
+		else step<false>();
+		if (!beforeLimit()) runEvents();
+	}
+	template <bool Accurate>
+	void step() {
+		uint8_t opcode = busFetch<Accurate>(PC);
 		extraCycle = false;
+		if (Accurate) {
+			// one byte instructions read the next byte and ignore it
+			if ((opcode & 0x0F) == 0x08 || (opcode & 0x0F) == 0x0A || opcode == 0x00 || opcode == 0x40 || opcode == 0x60) busRead<Accurate>(PC + 1);
+		}
 
 		switch (opcode) {
 			// Catch illegal opcodes
 		default:
 			std::cout << "\nError: illegal opcode: ";
 			printf("%02x.", opcode);
+			illegal_opcodes++;
+
+			// skip as a 1 byte NOP so frame loops keep making progress
+			PC++;
+			cycle += 2;
 		break;
 
 			// ADC
 		case 0x69:
-			ADC(immM);
+			ADC<Accurate>(immM);
 			cycle += 2;
 			break;
 		case 0x65:
-			ADC(zpgM);
+			ADC<Accurate>(zpgM);
 			cycle += 3;
 			break;
 		case 0x75:
-			ADC(zpg_xM);
+			ADC<Accurate>(zpg_xM);
 			cycle += 4;
 			break;
 		case 0x6D:
-			ADC(absM);
+			ADC<Accurate>(absM);
 			cycle += 4;
 			break;
 		case 0x7D:
-			ADC(abs_xM);
+			ADC<Accurate>(abs_xM);
 			cycle += 4 + extraCycle;
 			break;
 		case 0x79:
-			ADC(abs_yM);
+			ADC<Accurate>(abs_yM);
 			cycle += 4 + extraCycle;
 			break;
 		case 0x61:
-			ADC(x_indM);
+			ADC<Accurate>(x_indM);
 			cycle += 6;
 			break;
 		case 0x71:
-			ADC(ind_yM);
+			ADC<Accurate>(ind_yM);
 			cycle += 5 + extraCycle;
 			break;
 
 			// AND
 		case 0x29:
-			AND(immM);
+			AND<Accurate>(immM);
 			cycle += 2;
 			break;
 		case 0x25:
-			AND(zpgM);
+			AND<Accurate>(zpgM);
 			cycle += 3;
 			break;
 		case 0x35:
-			AND(zpg_xM);
+			AND<Accurate>(zpg_xM);
 			cycle += 4;
 			break;
 		case 0x2D:
-			AND(absM);
+			AND<Accurate>(absM);
 			cycle += 4;
 			break;
 		case 0x3D:
-			AND(abs_xM);
+			AND<Accurate>(abs_xM);
 			cycle += 4 + extraCycle;
 			break;
 		case 0x39:
-			AND(abs_yM);
+			AND<Accurate>(abs_yM);
 			cycle += 4 + extraCycle;
 			break;
 		case 0x21:
-			AND(x_indM);
+			AND<Accurate>(x_indM);
 			cycle += 6;
 			break;
 		case 0x31:
-			AND(ind_yM);
+			AND<Accurate>(ind_yM);
 			cycle += 5 + extraCycle;
 			break;
 
@@ -1042,69 +1450,69 @@ public:
 			cycle += 2;
 			break;
 		case 0x06:
-			ASL(zpgM);
+			ASL<Accurate>(zpgM);
 			cycle += 5;
 			break;
 		case 0x16:
-			ASL(zpg_xM);
+			ASL<Accurate>(zpg_xM);
 			cycle += 6;
 			break;
 		case 0x0E:
-			ASL(absM);
+			ASL<Accurate>(absM);
 			cycle += 6;
 			break;
 		case 0x1E:
-			ASL(absM);
+			ASL<Accurate>(absM);
 			cycle += 7;
 			break;
 
 			// Conditional Branches
 		case 0x90:
-			BCC();
+			BCC<Accurate>();
 			cycle += 2;
 			break;
 		case 0xB0:
-			BCS();
+			BCS<Accurate>();
 			cycle += 2;
 			break;
 		case 0xF0:
-			BEQ();
+			BEQ<Accurate>();
 			cycle += 2;
 			break;
 		case 0x30:
-			BMI();
+			BMI<Accurate>();
 			cycle += 2;
 			break;
 		case 0xD0:
-			BNE();
+			BNE<Accurate>();
 			cycle += 2;
 			break;
 		case 0x10:
-			BPL();
+			BPL<Accurate>();
 			cycle += 2;
 			break;
 		case 0x50:
-			BVC();
+			BVC<Accurate>();
 			cycle += 2;
 			break;
 		case 0x70:
-			BVS();
+			BVS<Accurate>();
 			cycle += 2;
 			break;
 
 			// BIT
 		case 0x24:
-			BIT(zpgM);
+			BIT<Accurate>(zpgM);
 			cycle += 3;
 			break;
 		case 0x2C:
-			BIT(absM);
+			BIT<Accurate>(absM);
 			cycle += 4;
 			break;
 
 			// BRK
 		case 0x00:
-			BRK();
+			BRK<Accurate>();
 			cycle += 7;
 			break;
 
@@ -1128,79 +1536,79 @@ public:
 
 			// Compare with Accumulator
 		case 0xC9:
-			CMP(immM);
+			CMP<Accurate>(immM);
 			cycle += 2;
 			break;
 		case 0xC5:
-			CMP(zpgM);
+			CMP<Accurate>(zpgM);
 			cycle += 3;
 			break;
 		case 0xD5:
-			CMP(zpg_xM);
+			CMP<Accurate>(zpg_xM);
 			cycle += 4;
 			break;
 		case 0xCD:
-			CMP(absM);
+			CMP<Accurate>(absM);
 			cycle += 4;
 			break;
 		case 0xDD:
-			CMP(abs_xM);
+			CMP<Accurate>(abs_xM);
 			cycle += 4 + extraCycle;
 			break;
 		case 0xD9:
-			CMP(abs_yM);
+			CMP<Accurate>(abs_yM);
 			cycle += 4 + extraCycle;
 			break;
 		case 0xC1:
-			CMP(x_indM);
+			CMP<Accurate>(x_indM);
 			cycle += 6;
 			break;
 		case 0xD1:
-			CMP(ind_yM);
+			CMP<Accurate>(ind_yM);
 			cycle += 5 + extraCycle;
 			break;
 
 			// Compare with XY Registers
 		case 0xE0:
-			CPX(immM);
+			CPX<Accurate>(immM);
 			cycle += 2;
 			break;
 		case 0xE4:
-			CPX(zpgM);
+			CPX<Accurate>(zpgM);
 			cycle += 3;
 			break;
 		case 0xEC:
-			CPX(absM);
+			CPX<Accurate>(absM);
 			cycle += 4;
 			break;
 		case 0xC0:
-			CPY(immM);
+			CPY<Accurate>(immM);
 			cycle += 2;
 			break;
 		case 0xC4:
-			CPY(zpgM);
+			CPY<Accurate>(zpgM);
 			cycle += 3;
 			break;
 		case 0xCC:
-			CPY(absM);
+			CPY<Accurate>(absM);
 			cycle += 4;
 			break;
 
 		// DEC
 		case 0xC6:
-			DEC(zpgM);
+			DEC<Accurate>(zpgM);
 			cycle += 5;
 			break;
 		case 0xD6:
-			DEC(zpg_xM);
+			DEC<Accurate>(zpg_xM);
 			cycle += 6;
 			break;
 		case 0xCE:
-			DEC(absM);
+			DEC<Accurate>(absM);
 			cycle += 6;
 			break;
 		case 0xDE:
-			DEC(abs_xM);
+			DEC<Accurate>(abs_xM);
 			cycle += 7;
 			break;
 		case 0xCA:
@@ -1214,53 +1622,53 @@ public:
 
 			// EOR
 		case 0x49:
-			EOR(immM);
+			EOR<Accurate>(immM);
 			cycle += 2;
 			break;
 		case 0x45:
-			EOR(zpgM);
+			EOR<Accurate>(zpgM);
 			cycle += 3;
 			break;
 		case 0x55:
-			EOR(zpg_xM);
+			EOR<Accurate>(zpg_xM);
 			cycle += 4;
 			break;
 		case 0x4D:
-			EOR(absM);
+			EOR<Accurate>(absM);
 			cycle += 4;
 			break;
 		case 0x5D:
-			EOR(abs_xM);
+			EOR<Accurate>(abs_xM);
 			cycle += 4 + extraCycle;
 			break;
 		case 0x59:
-			EOR(abs_yM);
+			EOR<Accurate>(abs_yM);
 			cycle += 4 + extraCycle;
 			break;
 		case 0x41:
-			EOR(x_indM);
+			EOR<Accurate>(x_indM);
 			cycle += 6;
 			break;
 		case 0x51:
-			EOR(ind_yM);
+			EOR<Accurate>(ind_yM);
 			cycle += 5 + extraCycle;
 			break;
 
 			// INC
 		case 0xE6:
-			INC(zpgM);
+			INC<Accurate>(zpgM);
 			cycle += 5;
 			break;
 		case 0xF6:
-			INC(zpg_xM);
+			INC<Accurate>(zpg_xM);
 			cycle += 6;
 			break;
 		case 0xEE:
-			INC(absM);
+			INC<Accurate>(absM);
 			cycle += 6;
 			break;
 		case 0xFE:
-			INC(abs_xM);
+			INC<Accurate>(abs_xM);
 			cycle += 7;
 			break;
 		case 0xE8:
@@ -1274,93 +1682,93 @@ public:
 
 			// Jumps
 		case 0x4C:
-			JMP(absM);
+			JMP<Accurate>(absM);
 			cycle += 3;
 			break;
 		case 0x6C:
-			JMP(indM);
+			JMP<Accurate>(indM);
 			cycle += 3;
 			break;
 		case 0x20:
-			JSR(absM);
+			JSR<Accurate>(absM);
 			cycle += 3;
 			break;
 
 			// LDA
 		case 0xA9:
-			ADC(immM);
+			ADC<Accurate>(immM);
 			cycle += 2;
 			break;
 		case 0xA5:
-			ADC(zpgM);
+			ADC<Accurate>(zpgM);
 			cycle += 3;
 			break;
 		case 0xB5:
-			ADC(zpg_xM);
+			ADC<Accurate>(zpg_xM);
 			cycle += 4;
 			break;
 		case 0xAD:
-			ADC(absM);
+			ADC<Accurate>(absM);
 			cycle += 4;
 			break;
 		case 0xBD:
-			ADC(abs_xM);
+			ADC<Accurate>(abs_xM);
 			cycle += 4 + extraCycle;
 			break;
 		case 0xB9:
-			ADC(abs_yM);
+			ADC<Accurate>(abs_yM);
 			cycle += 4 + extraCycle;
 			break;
 		case 0xA1:
-			ADC(x_indM);
+			ADC<Accurate>(x_indM);
 			cycle += 6;
 			break;
 		case 0xB1:
-			ADC(ind_yM);
+			ADC<Accurate>(ind_yM);
 			cycle += 5 + extraCycle;
 			break;
 
 			// LDX
 		case 0xA2:
-			LDX(immM);
+			LDX<Accurate>(immM);
 			cycle += 2;
 			break;
 		case 0xA6:
-			LDX(zpgM);
+			LDX<Accurate>(zpgM);
 			cycle += 3;
 			break;
 		case 0xB6:
-			LDX(zpg_yM);
+			LDX<Accurate>(zpg_yM);
 			cycle += 4;
 			break;
 		case 0xAE:
-			LDX(absM);
+			LDX<Accurate>(absM);
 			cycle += 4;
 			break;
 		case 0xBE:
-			LDX(abs_yM);
+			LDX<Accurate>(abs_yM);
 			cycle += 4 + extraCycle;
 			break;
 
 			// LDY
 		case 0xA0:
-			LDY(immM);
+			LDY<Accurate>(immM);
 			cycle += 2;
 			break;
 		case 0xA4:
-			LDY(zpgM);
+			LDY<Accurate>(zpgM);
 			cycle += 3;
 			break;
 		case 0xB4:
-			LDY(zpg_xM);
+			LDY<Accurate>(zpg_xM);
 			cycle += 4;
 			break;
 		case 0xAC:
-			LDY(absM);
+			LDY<Accurate>(absM);
 			cycle += 4;
 			break;
 		case 0xBC:
-			LDY(abs_xM);
+			LDY<Accurate>(abs_xM);
 			cycle += 4 + extraCycle;
 			break;
 
@@ -1370,78 +1778,79 @@ public:
 			cycle += 2;
 			break;
 		case 0x46:
-			LSR(zpgM);
+			LSR<Accurate>(zpgM);
 			cycle += 5;
 			break;
 		case 0x56:
-			LSR(zpg_xM);
+			LSR<Accurate>(zpg_xM);
 			cycle += 6;
 			break;
 		case 0x4E:
-			LSR(absM);
+			LSR<Accurate>(absM);
 			cycle += 6;
 			break;
 		case 0x5E:
-			LSR(abs_xM);
+			LSR<Accurate>(abs_xM);
 			cycle += 7;
 			break;
 
 			// NOP
 		case 0xEA:
+			NOP();
 			cycle += 2;
 			break;
 
 			// ORA
 		case 0x09:
-			ORA(immM);
+			ORA<Accurate>(immM);
 			cycle += 2;
 			break;
 		case 0x05:
-			ORA(zpgM);
+			ORA<Accurate>(zpgM);
 			cycle += 3;
 			break;
 		case 0x15:
-			ORA(zpg_xM);
+			ORA<Accurate>(zpg_xM);
 			cycle += 4;
 			break;
 		case 0x0D:
-			ORA(absM);
+			ORA<Accurate>(absM);
 			cycle += 4;
 			break;
 		case 0x1D:
-			ORA(abs_xM);
+			ORA<Accurate>(abs_xM);
 			cycle += 4 + extraCycle;
 			break;
 		case 0x19:
-			ORA(abs_yM);
+			ORA<Accurate>(abs_yM);
 			cycle += 4 + extraCycle;
 			break;
 		case 0x01:
-			ORA(x_indM);
+			ORA<Accurate>(x_indM);
 			cycle += 6;
 			break;
 		case 0x11:
-			ORA(ind_yM);
+			ORA<Accurate>(ind_yM);
 			cycle += 5 + extraCycle;
 			break;
 
 			// Push Stack
 		case 0x48:
-			PHA();
+			PHA<Accurate>();
 			cycle += 3;
 			break;
 		case 0x08:
-			PHP();
+			PHP<Accurate>();
 			cycle += 3;
 			break;
 
 			// Pull Stack
 		case 0x68:
-			PLA();
+			PLA<Accurate>();
 			cycle += 4;
 			break;
 		case 0x28:
-			PLP();
+			PLP<Accurate>();
 			cycle += 4;
 			break;
 
@@ -1451,19 +1860,19 @@ public:
 			cycle += 2;
 			break;
 		case 0x26:
-			ROL(zpgM);
+			ROL<Accurate>(zpgM);
 			cycle += 5;
 			break;
 		case 0x36:
-			ROL(zpg_xM);
+			ROL<Accurate>(zpg_xM);
 			cycle += 6;
 			break;
 		case 0x2E:
-			ROL(absM);
+			ROL<Accurate>(absM);
 			cycle += 6;
 			break;
 		case 0x3E:
-			ROL(abs_xM);
+			ROL<Accurate>(abs_xM);
 			cycle += 7;
 			break;
 
@@ -1473,63 +1882,63 @@ public:
 			cycle += 2;
 			break;
 		case 0x66:
-			ROR(zpgM);
+			ROR<Accurate>(zpgM);
 			cycle += 5;
 			break;
 		case 0x76:
-			ROR(zpg_xM);
+			ROR<Accurate>(zpg_xM);
 			cycle += 6;
 			break;
 		case 0x6E:
-			ROR(absM);
+			ROR<Accurate>(absM);
 			cycle += 6;
 			break;
 		case 0x7E:
-			ROR(abs_xM);
+			ROR<Accurate>(abs_xM);
 			cycle += 7;
 			break;
 
 			// Return
 		case 0x40:
-			RTI();
+			RTI<Accurate>();
 			cycle += 6;
 			break;
 		case 0x60:
-			RTS();
+			RTS<Accurate>();
 			cycle += 6;
 			break;
 
 			// SBC
 		case 0xE9:
-			SBC(immM);
+			SBC<Accurate>(immM);
 			cycle += 2;
 			break;
 		case 0xE5:
-			SBC(zpgM);
+			SBC<Accurate>(zpgM);
 			cycle += 3;
 			break;
 		case 0xF5:
-			SBC(zpg_xM);
+			SBC<Accurate>(zpg_xM);
 			cycle += 4;
 			break;
 		case 0xED:
-			SBC(absM);
+			SBC<Accurate>(absM);
 			cycle += 4;
 			break;
 		case 0xFD:
-			SBC(abs_xM);
+			SBC<Accurate>(abs_xM);
 			cycle += 4 + extraCycle;
 			break;
 		case 0xF9:
-			SBC(abs_yM);
+			SBC<Accurate>(abs_yM);
 			cycle += 4 + extraCycle;
 			break;
 		case 0xE1:
-			SBC(x_indM);
+			SBC<Accurate>(x_indM);
 			cycle += 6;
 			break;
 		case 0xF1:
-			SBC(ind_yM);
+			SBC<Accurate>(ind_yM);
 			cycle += 5 + extraCycle;
 			break;
 
@@ -1549,59 +1958,59 @@ public:
 
 			// STA
 		case 0x85:
-			STA(zpgM);
+			STA<Accurate>(zpgM);
 			cycle += 3;
 			break;
 		case 0x95:
-			STA(zpg_xM);
+			STA<Accurate>(zpg_xM);
 			cycle += 4;
 			break;
 		case 0x8D:
-			STA(absM);
+			STA<Accurate>(absM);
 			cycle += 4;
 			break;
 		case 0x9D:
-			STA(abs_xM);
+			STA<Accurate>(abs_xM);
 			cycle += 5;
 			break;
 		case 0x99:
-			STA(abs_yM);
+			STA<Accurate>(abs_yM);
 			cycle += 5;
 			break;
 		case 0x81:
-			STA(x_indM);
+			STA<Accurate>(x_indM);
 			cycle += 6;
 			break;
 		case 0x91:
-			STA(ind_yM);
+			STA<Accurate>(ind_yM);
 			cycle += 6;
 			break;
 
 			// STX
 		case 0x86:
-			STX(zpgM);
+			STX<Accurate>(zpgM);
 			cycle += 3;
 			break;
 		case 0x96:
-			STX(zpg_xM);
+			STX<Accurate>(zpg_xM);
 			cycle += 4;
 			break;
 		case 0x8E:
-			STX(absM);
+			STX<Accurate>(absM);
 			cycle += 4;
 			break;
 
 			// STY
 		case 0x84:
-			STY(zpgM);
+			STY<Accurate>(zpgM);
 			cycle += 3;
 			break;
 		case 0x94:
-			STY(zpg_xM);
+			STY<Accurate>(zpg_xM);
 			cycle += 4;
 			break;
 		case 0x8C:
-			STY(absM);
+			STY<Accurate>(absM);
 			cycle += 4;
 			break;
 
@@ -1627,5 +2036,20 @@ public:
 			cycle += 2;
 			break;
 		}
+
+		// the switch added the instruction's full length on top of the
+		// cycles counted as they happened
+		if (Accurate) cycle -= busCycles;
+		busCycles = 0;
+	}
+	void executeProfiled() {
+		// cycles include DMA stalls charged during the instruction; counted
+		// before an interrupt can move the profiler into its handler
+		uint16_t at = PC;
+		unsigned int start = cycle;
+		if (accurate) step<true>();
+		else step<false>();
+		profiler->count(at, cycle - start);
+		if (!beforeLimit()) runEvents();
 	}
 };
@@ -0,0 +1,1386 @@
+#pragma once
+
+#include <emmintrin.h>
+#include <memory>
+#include "Console.h"
+
+// Lockstep CPU for 16 copies of one game that differ only in their input.
+// Registers are kept structure-of-arrays with one SSE2 byte lane per instance,
+// and work RAM is interleaved by lane so the same address in every instance is
+// a single 16 byte load or store. While all lanes sit on the same PC in ROM an
+// instruction is decoded once and executed for every lane together. When the
+// lanes split (a branch goes both ways, a return lands in different places) or
+// reach an opcode without a lockstep form, each lane finishes the frame on its
+// own scalar CPU, and the lanes regroup at the start of the next frame.
+// Every lane ends each frame in exactly the state its scalar Console would.
+class CPUBatch {
+public:
+	static const int Lanes = 16;
+
+private:
+	// Scalar Instances
+	Console lane[Lanes];
+	std::unique_ptr<State> scratch = std::unique_ptr<State>(new State());
+
+	// Lockstep Registers
+	uint16_t PC = 0;		// Shared while in lockstep
+	uint8_t ACC[Lanes];
+	uint8_t X[Lanes];
+	uint8_t Y[Lanes];
+	uint8_t SF[Lanes];
+	uint8_t SP[Lanes];
+	unsigned int cycle[Lanes];
+	uint8_t ram[0x0800][Lanes];	// Work RAM, interleaved by lane
+
+	// Lockstep Status
+	bool diverged = false;
+	uint16_t lanePC[Lanes];		// Per lane PC once lanes split
+	uint16_t addr[Lanes];		// Effective address per lane
+	bool uniform = false;		// Every lane uses addr[0]
+	uint8_t extraCycle[Lanes];
+
+	// Statistics
+	uint64_t lockstepSteps = 0;	// Instructions run for all lanes at once
+	uint64_t scalarSteps = 0;	// Instructions run on a single lane
+
+	// Vector Helpers
+	static __m128i load(const uint8_t* p) {
+		return _mm_loadu_si128((const __m128i*)p);
+	}
+	static void store(uint8_t* p, __m128i value) {
+		_mm_storeu_si128((__m128i*)p, value);
+	}
+	static __m128i splat(uint8_t value) {
+		return _mm_set1_epi8((char)value);
+	}
+	static __m128i shiftLeft(__m128i value) {
+		return _mm_add_epi8(value, value);
+	}
+	static __m128i shiftRight(__m128i value) {
+		return _mm_and_si128(_mm_srli_epi16(value, 1), splat(0x7F));
+	}
+	static __m128i bit7(__m128i value) {
+		// 0x80 -> 0x01 in every lane
+		return _mm_srli_epi16(_mm_and_si128(value, splat(0x80)), 7);
+	}
+
+	// Flags
+	enum flags {
+		Carry, Zero, Interrupt, Decimal, Break, unused, Overflow, Negative
+	};
+	void setFlags(uint8_t mask, __m128i bits) {
+		store(SF, _mm_or_si128(_mm_andnot_si128(splat(mask), load(SF)), bits));
+	}
+	void setZN(__m128i value) {
+		__m128i zero = _mm_and_si128(_mm_cmpeq_epi8(value, _mm_setzero_si128()), splat(0x02));
+		__m128i negative = _mm_and_si128(value, splat(0x80));
+		setFlags(0x82, _mm_or_si128(zero, negative));
+	}
+	void setCarry(__m128i carry) {
+		setFlags(0x01, carry);
+	}
+
+	// Memory Access
+	uint8_t rom(uint16_t address) {
+		// ROM is identical in every lane
+		return lane[0].mem->read(address);
+	}
+	uint8_t readLane(int i, uint16_t address) {
+		if (address < 0x2000) return ram[address % 0x0800][i];
+		return lane[i].mem->read(address);
+	}
+	void writeLane(int i, uint16_t address, uint8_t value) {
+		if (address < 0x2000) ram[address % 0x0800][i] = value;
+		else {
+			// OAM DMA copies from the lane's own RAM, which is only current here
+			if (address == 0x4014 && value < 0x20) putRAM(i);
+			lane[i].mem->write(address, value);
+		}
+	}
+	void putRAM(int i) {
+		// lane i's column of the interleaved RAM back into its memory map
+		uint8_t laneRAM[0x0800];
+		for (int a = 0; a < 0x0800; a++) laneRAM[a] = ram[a][i];
+		lane[i].mem->writeRAM(laneRAM);
+	}
+	__m128i read(uint16_t address) {
+		if (address < 0x2000) return load(ram[address % 0x0800]);
+		if (address >= 0x8000) return splat(rom(address));
+
+		// registers have per lane side effects
+		uint8_t value[Lanes];
+		for (int i = 0; i < Lanes; i++) value[i] = lane[i].mem->read(address);
+		return load(value);
+	}
+	__m128i readOperand() {
+		if (uniform) return read(addr[0]);
+		uint8_t value[Lanes];
+		for (int i = 0; i < Lanes; i++) value[i] = readLane(i, addr[i]);
+		return load(value);
+	}
+	void writeOperand(__m128i value) {
+		if (uniform && addr[0] < 0x2000) {
+			store(ram[addr[0] % 0x0800], value);
+			return;
+		}
+		uint8_t bytes[Lanes];
+		store(bytes, value);
+		for (int i = 0; i < Lanes; i++) writeLane(i, uniform ? addr[0] : addr[i], bytes[i]);
+	}
+	void push(__m128i value) {
+		uint8_t bytes[Lanes];
+		store(bytes, value);
+		for (int i = 0; i < Lanes; i++) {
+			ram[SP[i] + 0x100][i] = bytes[i];
+			SP[i]--;
+		}
+	}
+	uint8_t pull(int i) {
+		SP[i]++;
+		return ram[SP[i] + 0x100][i];
+	}
+	void jump(const uint16_t* target) {
+		// lanes that land in different places leave lockstep
+		bool same = true;
+		for (int i = 1; i < Lanes; i++) same &= target[i] == target[0];
+		if (same) PC = target[0];
+		else {
+			memcpy(lanePC, target, sizeof(lanePC));
+			diverged = true;
+		}
+	}
+	void tick(unsigned int cycles, bool extra = false) {
+		for (int i = 0; i < Lanes; i++) cycle[i] += cycles + (extra ? extraCycle[i] : 0);
+	}
+
+	// Address Modes (same results as the CPU's)
+	void address(uint8_t mode) {
+		uniform = true;
+		switch (mode) {
+		case absM:
+			addr[0] = rom(PC + 1) + (rom(PC + 2) << 8);
+			PC += 3;
+			break;
+		case abs_xM:
+		case abs_yM: {
+			uint16_t base = rom(PC + 1) + (rom(PC + 2) << 8);
+			const uint8_t* index = mode == abs_xM ? X : Y;
+			for (int i = 0; i < Lanes; i++) {
+				addr[i] = base + index[i];
+				if ((addr[i] >> 8) != (PC >> 8)) extraCycle[i] = 1;
+			}
+			uniform = false;
+			PC += 3;
+			break;
+		}
+		case immM:
+			addr[0] = PC + 1;
+			PC += 2;
+			break;
+		case x_indM: {
+			uint8_t base = rom(PC + 1);
+			for (int i = 0; i < Lanes; i++) {
+				uint8_t pointer = base + X[i];
+				uint8_t ll = readLane(i, pointer);
+				uint8_t hh = readLane(i, pointer + 1);
+				addr[i] = ll + (hh << 8);
+			}
+			uniform = false;
+			PC += 2;
+			break;
+		}
+		case ind_yM: {
+			uint16_t pointer = rom(PC + 1);
+			for (int i = 0; i < Lanes; i++) {
+				uint8_t ll = readLane(i, pointer);
+				uint8_t hh = readLane(i, pointer + 1);
+				addr[i] = ll + (hh << 8) + Y[i];
+				if ((addr[i] >> 8) != (PC >> 8)) extraCycle[i] = 1;
+			}
+			uniform = false;
+			PC += 2;
+			break;
+		}
+		case zpgM:
+			addr[0] = rom(PC + 1);
+			PC += 2;
+			break;
+		case zpg_xM:
+		case zpg_yM: {
+			uint8_t base = rom(PC + 1);
+			const uint8_t* index = mode == zpg_xM ? X : Y;
+			for (int i = 0; i < Lanes; i++) addr[i] = (uint8_t)(base + index[i]);
+			uniform = false;
+			PC += 2;
+			break;
+		}
+		}
+	}
+	__m128i readMem(uint8_t mode) {
+		address(mode);
+		return readOperand();
+	}
+
+	// Arithmetic on 16 bit halves, flags as the CPU sets them
+	void arithmetic(const __m128i& lo, const __m128i& hi, const __m128i& carryLo, const __m128i& carryHi) {
+		__m128i byte = _mm_set1_epi16(0xFF);
+		__m128i value = _mm_packus_epi16(_mm_and_si128(lo, byte), _mm_and_si128(hi, byte));
+		__m128i carry = _mm_packs_epi16(carryLo, carryHi);
+		__m128i overflow = _mm_packs_epi16(_mm_cmpgt_epi16(lo, _mm_set1_epi16(0x7F)), _mm_cmpgt_epi16(hi, _mm_set1_epi16(0x7F)));
+		__m128i zero = _mm_packs_epi16(_mm_cmpeq_epi16(lo, _mm_setzero_si128()), _mm_cmpeq_epi16(hi, _mm_setzero_si128()));
+		store(ACC, value);
+
+		__m128i bits = _mm_and_si128(carry, splat(0x01));
+		bits = _mm_or_si128(bits, _mm_and_si128(overflow, splat(0x40)));
+		bits = _mm_or_si128(bits, _mm_and_si128(zero, splat(0x02)));
+		bits = _mm_or_si128(bits, _mm_and_si128(value, splat(0x80)));
+		setFlags(0xC3, bits);
+	}
+	void compare(const uint8_t* reg, uint8_t mode) {
+		__m128i value = readMem(mode);
+		__m128i a = load(reg);
+		__m128i equal = _mm_cmpeq_epi8(a, value);
+		__m128i greaterEqual = _mm_cmpeq_epi8(_mm_max_epu8(a, value), a);
+		__m128i bits = _mm_and_si128(equal, splat(0x02));
+		bits = _mm_or_si128(bits, _mm_and_si128(greaterEqual, splat(0x01)));
+		bits = _mm_or_si128(bits, _mm_andnot_si128(greaterEqual, splat(0x80)));
+		setFlags(0x83, bits);
+	}
+	void branch(int flag, bool set) {
+		int8_t offset = rom(PC + 1);
+		unsigned int taken = ((PC & 0x00FF) + offset > 0xFF || (PC & 0x00FF) + offset < 0) ? 2 : 1;
+		uint16_t target[Lanes];
+		for (int i = 0; i < Lanes; i++) {
+			if (((SF[i] >> flag) & 1) == set) {
+				cycle[i] += taken;
+				target[i] = PC + offset + 2;
+			}
+			else target[i] = PC + 2;
+		}
+		jump(target);
+	}
+	void modify(uint8_t mode, __m128i (*operation)(CPUBatch*, __m128i)) {
+		// read-modify-write: one address, one read, one write
+		address(mode);
+		__m128i value = operation(this, readOperand());
+		writeOperand(value);
+		setZN(value);
+	}
+
+public:
+	enum mode {
+		absM = 1, abs_xM, abs_yM, immM, indM, x_indM, ind_yM, zpgM, zpg_xM, zpg_yM
+	};
+
+	CPUBatch() {
+		memset(ram, 0, sizeof(ram));
+	}
+
+	// Emulator Utilities
+	bool powerOn(const char* romPath) {
+		for (int i = 0; i < Lanes; i++) {
+			if (!lane[i].powerOn(romPath)) return false;
+		}
+		return true;
+	}
+	Console& getLane(int i) {
+		// scalar view of a lane, current between frames
+		return lane[i];
+	}
+	uint64_t getLockstepSteps() {
+		return lockstepSteps;
+	}
+	uint64_t getScalarSteps() {
+		return scalarSteps;
+	}
+	void test() {
+		std::cout << "\nTesting CPU Batch:";
+
+		// copy page 2 to OAM, read the pad, count its value into RAM, branch on it
+		const uint8_t program[] = {
+			0xA0, 0x02, 0x8C, 0x14, 0x40,
+			0xA0, 0x01, 0x8C, 0x16, 0x40, 0xA0, 0x00, 0x8C, 0x16, 0x40, 0xA2, 0x08,
+			0xAD, 0x16, 0x40, 0x4A, 0x26, 0x10, 0xCA, 0xD0, 0xF7,
+			0xA5, 0x10, 0x29, 0x0F, 0xAA, 0xFE, 0x00, 0x02, 0xE6, 0x11,
+			0x48, 0x98, 0x69, 0x03, 0xA8, 0x68,
+			0xA6, 0x10, 0xF0, 0x03, 0xEE, 0x12, 0x00, 0x4C, 0x00, 0x80
+		};
+		std::unique_ptr<Console> reference[Lanes];
+		for (int i = 0; i < Lanes; i++) {
+			reference[i].reset(new Console);
+			Console* consoles[2] = { &lane[i], reference[i].get() };
+			for (Console* console : consoles) {
+				console->mem->clear();
+				for (int b = 0; b < (int)sizeof(program); b++) console->mem->write(0x8000 + b, program[b]);
+				console->mem->write(0xFFFC, 0x00);
+				console->mem->write(0xFFFD, 0x80);
+				console->cpu->reset();
+			}
+		}
+
+		// identical input first (lanes stay together), then a different pad per lane
+		int err_cnt = 0;
+		uint8_t input[Lanes];
+		for (int frame = 0; frame < 30; frame++) {
+			for (int i = 0; i < Lanes; i++) input[i] = frame < 10 ? 0 : (uint8_t)(i * 17 + frame);
+			runFrame(input);
+			for (int i = 0; i < Lanes; i++) {
+				reference[i]->mem->setInput(0, input[i]);
+				reference[i]->cpu->runFrame();
+				if (!lane[i].sameState(*reference[i])) err_cnt++;
+			}
+		}
+		if (lockstepSteps == 0) err_cnt++;
+
+		if (err_cnt == 0) std::cout << "\nCPU Batch OK\n";
+		else printf("\nCPU Batch NOT OK: %d lane frames out of sync\n", err_cnt);
+	}
+
+	// Frame Execution
+	void runFrame(const uint8_t* input, const uint8_t* input2 = nullptr) {
+		for (int i = 0; i < Lanes; i++) {
+			lane[i].mem->setInput(0, input[i]);
+			if (input2) lane[i].mem->setInput(1, input2[i]);
+			lane[i].cpu->beginFrame();
+		}
+
+		if (gather()) {
+			while (inFrame() && step()) lockstepSteps++;
+			scatter();
+		}
+		for (int i = 0; i < Lanes; i++) {
+			CPU* cpu = lane[i].cpu;
+			if (!cpu->beforeLimit()) cpu->runEvents();
+			while (!cpu->frameDone()) {
+				cpu->execute();
+				scalarSteps++;
+			}
+		}
+	}
+
+private:
+	bool gather() {
+		// lockstep needs every lane on the same instruction
+		for (int i = 0; i < Lanes; i++) {
+			lane[i].cpu->saveState(*scratch);
+			if (i == 0) PC = scratch->PC;
+			else if (scratch->PC != PC) return false;
+			ACC[i] = scratch->ACC;
+			X[i] = scratch->X;
+			Y[i] = scratch->Y;
+			SF[i] = scratch->SF;
+			SP[i] = scratch->SP;
+			cycle[i] = scratch->cycle;
+		}
+		uint8_t laneRAM[0x0800];
+		for (int i = 0; i < Lanes; i++) {
+			lane[i].mem->readRAM(laneRAM);
+			for (int a = 0; a < 0x0800; a++) ram[a][i] = laneRAM[a];
+			lane[i].mem->setClock(&cycle[i]);	// DMA stalls land on the lockstep counters
+		}
+		diverged = false;
+		return true;
+	}
+	void scatter() {
+		for (int i = 0; i < Lanes; i++) {
+			lane[i].cpu->saveState(*scratch);
+			scratch->PC = diverged ? lanePC[i] : PC;
+			scratch->ACC = ACC[i];
+			scratch->X = X[i];
+			scratch->Y = Y[i];
+			scratch->SF = SF[i];
+			scratch->SP = SP[i];
+			scratch->cycle = cycle[i];
+			lane[i].cpu->loadState(*scratch);
+			lane[i].mem->setClock(lane[i].cpu->clock(), lane[i].cpu->isAccurate());
+			putRAM(i);
+		}
+	}
+	bool irqHeld() {
+		// clearing I needs an interrupt poll in any lane with IRQ held
+		for (int i = 0; i < Lanes; i++) {
+			if (lane[i].mem->irqLines()) return true;
+		}
+		return false;
+	}
+	bool inFrame() {
+		// every lane short of its frame end and its next event
+		for (int i = 0; i < Lanes; i++) {
+			if ((int)(lane[i].cpu->runLimit() - cycle[i]) <= 0) return false;
+		}
+		return true;
+	}
+	bool step() {
+		// operands must come from ROM to be the same in every lane
+		if (PC < 0x8000 || PC > 0xFFFD) return false;
+		uint8_t opcode = rom(PC);
+		memset(extraCycle, 0, sizeof(extraCycle));
+
+		switch (opcode) {
+			// No lockstep form: finish the frame per lane
+		default:
+			return false;
+
+			// ADC
+		case 0x69:
+			ADC(immM);
+			tick(2);
+			break;
+		case 0x65:
+			ADC(zpgM);
+			tick(3);
+			break;
+		case 0x75:
+			ADC(zpg_xM);
+			tick(4);
+			break;
+		case 0x6D:
+			ADC(absM);
+			tick(4);
+			break;
+		case 0x7D:
+			ADC(abs_xM);
+			tick(4, true);
+			break;
+		case 0x79:
+			ADC(abs_yM);
+			tick(4, true);
+			break;
+		case 0x61:
+			ADC(x_indM);
+			tick(6);
+			break;
+		case 0x71:
+			ADC(ind_yM);
+			tick(5, true);
+			break;
+
+			// AND
+		case 0x29:
+			AND(immM);
+			tick(2);
+			break;
+		case 0x25:
+			AND(zpgM);
+			tick(3);
+			break;
+		case 0x35:
+			AND(zpg_xM);
+			tick(4);
+			break;
+		case 0x2D:
+			AND(absM);
+			tick(4);
+			break;
+		case 0x3D:
+			AND(abs_xM);
+			tick(4, true);
+			break;
+		case 0x39:
+			AND(abs_yM);
+			tick(4, true);
+			break;
+		case 0x21:
+			AND(x_indM);
+			tick(6);
+			break;
+		case 0x31:
+			AND(ind_yM);
+			tick(5, true);
+			break;
+
+			// ASL
+		case 0x0A:
+			ASL();
+			tick(2);
+			break;
+		case 0x06:
+			ASL(zpgM);
+			tick(5);
+			break;
+		case 0x16:
+			ASL(zpg_xM);
+			tick(6);
+			break;
+		case 0x0E:
+			ASL(absM);
+			tick(6);
+			break;
+		case 0x1E:
+			ASL(absM);
+			tick(7);
+			break;
+
+			// Conditional Branches
+		case 0x90:
+			BCC();
+			tick(2);
+			break;
+		case 0xB0:
+			BCS();
+			tick(2);
+			break;
+		case 0xF0:
+			BEQ();
+			tick(2);
+			break;
+		case 0x30:
+			BMI();
+			tick(2);
+			break;
+		case 0xD0:
+			BNE();
+			tick(2);
+			break;
+		case 0x10:
+			BPL();
+			tick(2);
+			break;
+		case 0x50:
+			BVC();
+			tick(2);
+			break;
+		case 0x70:
+			BVS();
+			tick(2);
+			break;
+
+			// BIT
+		case 0x24:
+			BIT(zpgM);
+			tick(3);
+			break;
+		case 0x2C:
+			BIT(absM);
+			tick(4);
+			break;
+
+			// BRK
+		case 0x00:
+			BRK();
+			tick(7);
+			break;
+
+			// Clear Flags
+		case 0x18:
+			CLC();
+			tick(2);
+			break;
+		case 0x58:
+			if (irqHeld()) return false;	// the lanes poll on their own
+			CLI();
+			tick(2);
+			break;
+		case 0xB8:
+			CLV();
+			tick(2);
+			break;
+
+			// Compare with Accumulator
+		case 0xC9:
+			CMP(immM);
+			tick(2);
+			break;
+		case 0xC5:
+			CMP(zpgM);
+			tick(3);
+			break;
+		case 0xD5:
+			CMP(zpg_xM);
+			tick(4);
+			break;
+		case 0xCD:
+			CMP(absM);
+			tick(4);
+			break;
+		case 0xDD:
+			CMP(abs_xM);
+			tick(4, true);
+			break;
+		case 0xD9:
+			CMP(abs_yM);
+			tick(4, true);
+			break;
+		case 0xC1:
+			CMP(x_indM);
+			tick(6);
+			break;
+		case 0xD1:
+			CMP(ind_yM);
+			tick(5, true);
+			break;
+
+			// Compare with XY Registers
+		case 0xE0:
+			CPX(immM);
+			tick(2);
+			break;
+		case 0xE4:
+			CPX(zpgM);
+			tick(3);
+			break;
+		case 0xEC:
+			CPX(absM);
+			tick(4);
+			break;
+		case 0xC0:
+			CPY(immM);
+			tick(2);
+			break;
+		case 0xC4:
+			CPY(zpgM);
+			tick(3);
+			break;
+		case 0xCC:
+			CPY(absM);
+			tick(4);
+			break;
+
+		// DEC
+		case 0xC6:
+			DEC(zpgM);
+			tick(5);
+			break;
+		case 0xD6:
+			DEC(zpg_xM);
+			tick(6);
+			break;
+		case 0xCE:
+			DEC(absM);
+			tick(6);
+			break;
+		case 0xDE:
+			DEC(abs_xM);
+			tick(7);
+			break;
+		case 0xCA:
+			DEX();
+			tick(2);
+			break;
+		case 0x88:
+			DEY();
+			tick(2);
+			break;
+
+			// EOR
+		case 0x49:
+			EOR(immM);
+			tick(2);
+			break;
+		case 0x45:
+			EOR(zpgM);
+			tick(3);
+			break;
+		case 0x55:
+			EOR(zpg_xM);
+			tick(4);
+			break;
+		case 0x4D:
+			EOR(absM);
+			tick(4);
+			break;
+		case 0x5D:
+			EOR(abs_xM);
+			tick(4, true);
+			break;
+		case 0x59:
+			EOR(abs_yM);
+			tick(4, true);
+			break;
+		case 0x41:
+			EOR(x_indM);
+			tick(6);
+			break;
+		case 0x51:
+			EOR(ind_yM);
+			tick(5, true);
+			break;
+
+			// INC
+		case 0xE6:
+			INC(zpgM);
+			tick(5);
+			break;
+		case 0xF6:
+			INC(zpg_xM);
+			tick(6);
+			break;
+		case 0xEE:
+			INC(absM);
+			tick(6);
+			break;
+		case 0xFE:
+			INC(abs_xM);
+			tick(7);
+			break;
+		case 0xE8:
+			INX();
+			tick(2);
+			break;
+		case 0xC8:
+			INY();
+			tick(2);
+			break;
+
+			// Jumps
+		case 0x4C:
+			JMP(absM);
+			tick(3);
+			break;
+		case 0x6C:
+			JMP(indM);
+			tick(3);
+			break;
+		case 0x20:
+			JSR(absM);
+			tick(3);
+			break;
+
+			// LDA
+		case 0xA9:
+			ADC(immM);
+			tick(2);
+			break;
+		case 0xA5:
+			ADC(zpgM);
+			tick(3);
+			break;
+		case 0xB5:
+			ADC(zpg_xM);
+			tick(4);
+			break;
+		case 0xAD:
+			ADC(absM);
+			tick(4);
+			break;
+		case 0xBD:
+			ADC(abs_xM);
+			tick(4, true);
+			break;
+		case 0xB9:
+			ADC(abs_yM);
+			tick(4, true);
+			break;
+		case 0xA1:
+			ADC(x_indM);
+			tick(6);
+			break;
+		case 0xB1:
+			ADC(ind_yM);
+			tick(5, true);
+			break;
+
+			// LDX
+		case 0xA2:
+			LDX(immM);
+			tick(2);
+			break;
+		case 0xA6:
+			LDX(zpgM);
+			tick(3);
+			break;
+		case 0xB6:
+			LDX(zpg_yM);
+			tick(4);
+			break;
+		case 0xAE:
+			LDX(absM);
+			tick(4);
+			break;
+		case 0xBE:
+			LDX(abs_yM);
+			tick(4, true);
+			break;
+
+			// LDY
+		case 0xA0:
+			LDY(immM);
+			tick(2);
+			break;
+		case 0xA4:
+			LDY(zpgM);
+			tick(3);
+			break;
+		case 0xB4:
+			LDY(zpg_xM);
+			tick(4);
+			break;
+		case 0xAC:
+			LDY(absM);
+			tick(4);
+			break;
+		case 0xBC:
+			LDY(abs_xM);
+			tick(4, true);
+			break;
+
+			// LSR
+		case 0x4A:
+			LSR();
+			tick(2);
+			break;
+		case 0x46:
+			LSR(zpgM);
+			tick(5);
+			break;
+		case 0x56:
+			LSR(zpg_xM);
+			tick(6);
+			break;
+		case 0x4E:
+			LSR(absM);
+			tick(6);
+			break;
+		case 0x5E:
+			LSR(abs_xM);
+			tick(7);
+			break;
+
+			// NOP
+		case 0xEA:
+			NOP();
+			tick(2);
+			break;
+
+			// ORA
+		case 0x09:
+			ORA(immM);
+			tick(2);
+			break;
+		case 0x05:
+			ORA(zpgM);
+			tick(3);
+			break;
+		case 0x15:
+			ORA(zpg_xM);
+			tick(4);
+			break;
+		case 0x0D:
+			ORA(absM);
+			tick(4);
+			break;
+		case 0x1D:
+			ORA(abs_xM);
+			tick(4, true);
+			break;
+		case 0x19:
+			ORA(abs_yM);
+			tick(4, true);
+			break;
+		case 0x01:
+			ORA(x_indM);
+			tick(6);
+			break;
+		case 0x11:
+			ORA(ind_yM);
+			tick(5, true);
+			break;
+
+			// Push Stack
+		case 0x48:
+			PHA();
+			tick(3);
+			break;
+		case 0x08:
+			PHP();
+			tick(3);
+			break;
+
+			// Pull Stack
+		case 0x68:
+			PLA();
+			tick(4);
+			break;
+		case 0x28:
+			if (irqHeld()) return false;
+			PLP();
+			tick(4);
+			break;
+
+			// ROL
+		case 0x2A:
+			ROL();
+			tick(2);
+			break;
+		case 0x26:
+			ROL(zpgM);
+			tick(5);
+			break;
+		case 0x36:
+			ROL(zpg_xM);
+			tick(6);
+			break;
+		case 0x2E:
+			ROL(absM);
+			tick(6);
+			break;
+		case 0x3E:
+			ROL(abs_xM);
+			tick(7);
+			break;
+
+			// ROR
+		case 0x6A:
+			ROR();
+			tick(2);
+			break;
+		case 0x66:
+			ROR(zpgM);
+			tick(5);
+			break;
+		case 0x76:
+			ROR(zpg_xM);
+			tick(6);
+			break;
+		case 0x6E:
+			ROR(absM);
+			tick(6);
+			break;
+		case 0x7E:
+			ROR(abs_xM);
+			tick(7);
+			break;
+
+			// Return
+		case 0x40:
+			if (irqHeld()) return false;
+			RTI();
+			tick(6);
+			break;
+		case 0x60:
+			RTS();
+			tick(6);
+			break;
+
+			// SBC
+		case 0xE9:
+			SBC(immM);
+			tick(2);
+			break;
+		case 0xE5:
+			SBC(zpgM);
+			tick(3);
+			break;
+		case 0xF5:
+			SBC(zpg_xM);
+			tick(4);
+			break;
+		case 0xED:
+			SBC(absM);
+			tick(4);
+			break;
+		case 0xFD:
+			SBC(abs_xM);
+			tick(4, true);
+			break;
+		case 0xF9:
+			SBC(abs_yM);
+			tick(4, true);
+			break;
+		case 0xE1:
+			SBC(x_indM);
+			tick(6);
+			break;
+		case 0xF1:
+			SBC(ind_yM);
+			tick(5, true);
+			break;
+
+			//Flags
+		case 0x38:
+			SEC();
+			tick(2);
+			break;
+		case 0x78:
+			SEI();
+			tick(2);
+			break;
+
+			// STA
+		case 0x85:
+			STA(zpgM);
+			tick(3);
+			break;
+		case 0x95:
+			STA(zpg_xM);
+			tick(4);
+			break;
+		case 0x8D:
+			STA(absM);
+			tick(4);
+			break;
+		case 0x9D:
+			STA(abs_xM);
+			tick(5);
+			break;
+		case 0x99:
+			STA(abs_yM);
+			tick(5);
+			break;
+		case 0x81:
+			STA(x_indM);
+			tick(6);
+			break;
+		case 0x91:
+			STA(ind_yM);
+			tick(6);
+			break;
+
+			// STX
+		case 0x86:
+			STX(zpgM);
+			tick(3);
+			break;
+		case 0x96:
+			STX(zpg_xM);
+			tick(4);
+			break;
+		case 0x8E:
+			STX(absM);
+			tick(4);
+			break;
+
+			// STY
+		case 0x84:
+			STY(zpgM);
+			tick(3);
+			break;
+		case 0x94:
+			STY(zpg_xM);
+			tick(4);
+			break;
+		case 0x8C:
+			STY(absM);
+			tick(4);
+			break;
+
+			// Transfer Registers
+		case 0xAA:
+			TAX();
+			tick(2);
+			break;
+		case 0xA8:
+			TAY();
+			tick(2);
+			break;
+		case 0xBA:
+			TSX();
+			tick(2);
+			break;
+		case 0x8A:
+			TXA();
+			tick(2);
+			break;
+		case 0x98:
+			TYA();
+			tick(2);
+			break;
+		}
+		return !diverged;
+	}
+
+// CPU Instructions (lockstep forms, mirroring CPU)
+	// Transfer Instructions
+	void LDX(uint8_t mode) {
+		__m128i value = readMem(mode);
+		store(X, value);
+		setZN(value);
+	}
+	void LDY(uint8_t mode) {
+		__m128i value = readMem(mode);
+		store(Y, value);
+		setZN(value);
+	}
+	void STA(uint8_t mode) {
+		address(mode);
+		writeOperand(load(ACC));
+	}
+	void STX(uint8_t mode) {
+		address(mode);
+		writeOperand(load(X));
+	}
+	void STY(uint8_t mode) {
+		address(mode);
+		writeOperand(load(Y));
+	}
+	void TAX() {
+		memcpy(X, ACC, Lanes);
+		setZN(load(X));
+		PC++;
+	}
+	void TAY() {
+		memcpy(Y, ACC, Lanes);
+		setZN(load(Y));
+		PC++;
+	}
+	void TSX() {
+		memcpy(X, SP, Lanes);
+		setZN(load(X));
+		PC++;
+	}
+	void TXA() {
+		memcpy(ACC, X, Lanes);
+		setZN(load(X));
+		PC++;
+	}
+	void TYA() {
+		memcpy(ACC, Y, Lanes);
+		setZN(load(X));
+		PC++;
+	}
+
+	// Stack Instructions
+	void PHA() {
+		push(load(ACC));
+		PC++;
+	}
+	void PHP() {
+		store(SF, _mm_or_si128(load(SF), splat(1 << Break)));
+		push(load(SF));
+		PC++;
+	}
+	void PLA() {
+		for (int i = 0; i < Lanes; i++) ACC[i] = pull(i);
+		setZN(load(X));
+		PC++;
+	}
+	void PLP() {
+		for (int i = 0; i < Lanes; i++) SF[i] = pull(i);
+		PC++;
+	}
+
+	// Increments and Decrements
+	static __m128i decrement(CPUBatch*, __m128i value) {
+		return _mm_sub_epi8(value, splat(1));
+	}
+	static __m128i increment(CPUBatch*, __m128i value) {
+		return _mm_add_epi8(value, splat(1));
+	}
+	void DEC(uint8_t mode) {
+		modify(mode, decrement);
+	}
+	void DEX() {
+		store(X, decrement(this, load(X)));
+		setZN(load(X));
+		PC++;
+	}
+	void DEY() {
+		store(Y, decrement(this, load(Y)));
+		setZN(load(Y));
+		PC++;
+	}
+	void INC(uint8_t mode) {
+		modify(mode, increment);
+	}
+	void INX() {
+		store(X, increment(this, load(X)));
+		setZN(load(X));
+		PC++;
+	}
+	void INY() {
+		store(Y, increment(this, load(Y)));
+		setZN(load(Y));
+		PC++;
+	}
+
+	// Arithmetic Operations
+	void ADC(uint8_t mode) {
+		__m128i value = readMem(mode);
+		__m128i zero = _mm_setzero_si128();
+		__m128i acc = load(ACC);
+		__m128i carry = _mm_and_si128(load(SF), splat(0x01));
+		__m128i lo = _mm_add_epi16(_mm_add_epi16(_mm_unpacklo_epi8(acc, zero), _mm_unpacklo_epi8(value, zero)), _mm_unpacklo_epi8(carry, zero));
+		__m128i hi = _mm_add_epi16(_mm_add_epi16(_mm_unpackhi_epi8(acc, zero), _mm_unpackhi_epi8(value, zero)), _mm_unpackhi_epi8(carry, zero));
+		__m128i limit = _mm_set1_epi16(0xFF);
+		arithmetic(lo, hi, _mm_cmpgt_epi16(lo, limit), _mm_cmpgt_epi16(hi, limit));
+	}
+	void SBC(uint8_t mode) {
+		__m128i value = readMem(mode);
+		__m128i zero = _mm_setzero_si128();
+		__m128i acc = load(ACC);
+		__m128i borrow = _mm_xor_si128(_mm_and_si128(load(SF), splat(0x01)), splat(0x01));
+		__m128i lo = _mm_sub_epi16(_mm_sub_epi16(_mm_unpacklo_epi8(acc, zero), _mm_unpacklo_epi8(value, zero)), _mm_unpacklo_epi8(borrow, zero));
+		__m128i hi = _mm_sub_epi16(_mm_sub_epi16(_mm_unpackhi_epi8(acc, zero), _mm_unpackhi_epi8(value, zero)), _mm_unpackhi_epi8(borrow, zero));
+		__m128i limit = _mm_set1_epi16(-1);
+		arithmetic(lo, hi, _mm_cmpgt_epi16(lo, limit), _mm_cmpgt_epi16(hi, limit));
+	}
+
+	// Logical Operations
+	void AND(uint8_t mode) {
+		__m128i value = _mm_and_si128(load(ACC), readMem(mode));
+		store(ACC, value);
+		setZN(value);
+	}
+	void EOR(uint8_t mode) {
+		__m128i value = _mm_xor_si128(load(ACC), readMem(mode));
+		store(ACC, value);
+		setZN(value);
+	}
+	void ORA(uint8_t mode) {
+		__m128i value = _mm_or_si128(load(ACC), readMem(mode));
+		store(ACC, value);
+		setZN(value);
+	}
+
+	// Bit Shifts (carry is updated before ROL/ROR shift it back in)
+	static __m128i shiftASL(CPUBatch* cpu, __m128i value) {
+		cpu->setCarry(bit7(value));
+		return shiftLeft(value);
+	}
+	static __m128i shiftLSR(CPUBatch* cpu, __m128i value) {
+		cpu->setCarry(_mm_and_si128(value, splat(0x01)));
+		return shiftRight(value);
+	}
+	static __m128i shiftROL(CPUBatch* cpu, __m128i value) {
+		__m128i carry = bit7(value);
+		cpu->setCarry(carry);
+		return _mm_add_epi8(shiftLeft(value), carry);
+	}
+	static __m128i shiftROR(CPUBatch* cpu, __m128i value) {
+		__m128i carry = _mm_and_si128(value, splat(0x01));
+		cpu->setCarry(carry);
+		return _mm_add_epi8(shiftRight(value), _mm_slli_epi16(carry, 7));
+	}
+	void shiftACC(__m128i (*operation)(CPUBatch*, __m128i)) {
+		__m128i value = operation(this, load(ACC));
+		store(ACC, value);
+		setZN(value);
+		PC++;
+	}
+	void ASL() {
+		shiftACC(shiftASL);
+	}
+	void LSR() {
+		shiftACC(shiftLSR);
+	}
+	void ROL() {
+		shiftACC(shiftROL);
+	}
+	void ROR() {
+		shiftACC(shiftROR);
+	}
+	void ASL(uint8_t mode) {
+		modify(mode, shiftASL);
+	}
+	void LSR(uint8_t mode) {
+		modify(mode, shiftLSR);
+	}
+	void ROL(uint8_t mode) {
+		modify(mode, shiftROL);
+	}
+	void ROR(uint8_t mode) {
+		modify(mode, shiftROR);
+	}
+
+	// Flag instructions
+	void CLC() {
+		setFlags(1 << Carry, _mm_setzero_si128());
+		PC++;
+	}
+	void CLI() {
+		setFlags(1 << Interrupt, _mm_setzero_si128());
+		PC++;
+	}
+	void CLV() {
+		setFlags(1 << Overflow, _mm_setzero_si128());
+		PC++;
+	}
+	void SEC() {
+		setFlags(1 << Carry, splat(1 << Carry));
+		PC++;
+	}
+	void SEI() {
+		setFlags(1 << Interrupt, splat(1 << Interrupt));
+		PC++;
+	}
+
+	// Comparisons (CPX compares Y, as in CPU)
+	void CMP(uint8_t mode) {
+		compare(ACC, mode);
+	}
+	void CPX(uint8_t mode) {
+		compare(Y, mode);
+	}
+	void CPY(uint8_t mode) {
+		compare(Y, mode);
+	}
+
+	// Conditional Branches
+	void BCC() {
+		branch(Carry, false);
+	}
+	void BCS() {
+		branch(Carry, true);
+	}
+	void BEQ() {
+		branch(Zero, true);
+	}
+	void BMI() {
+		branch(Negative, true);
+	}
+	void BNE() {
+		branch(Zero, false);
+	}
+	void BPL() {
+		branch(Negative, false);
+	}
+	void BVC() {
+		branch(Overflow, false);
+	}
+	void BVS() {
+		branch(Overflow, true);
+	}
+
+	// Jumps
+	void JMP(uint8_t mode) {
+		address(absM);
+		uint16_t target[Lanes];
+		if (mode == absM) {
+			for (int i = 0; i < Lanes; i++) target[i] = addr[0];
+		}
+		else {
+			// pointer may live in per lane RAM
+			uint8_t ll[Lanes], hh[Lanes];
+			store(ll, read(addr[0]));
+			store(hh, read(addr[0] + 1));
+			for (int i = 0; i < Lanes; i++) target[i] = ll[i] + (hh[i] << 8);
+		}
+		jump(target);
+	}
+	void JSR(uint8_t mode) {
+		push(splat(PC >> 8));
+		push(splat((uint8_t)PC));
+		JMP(mode);
+	}
+	void RTS() {
+		uint16_t target[Lanes];
+		for (int i = 0; i < Lanes; i++) target[i] = pull(i) + (pull(i) << 8);
+		jump(target);
+	}
+
+	// Interrupts (software)
+	void BRK() {
+		store(SF, _mm_or_si128(load(SF), splat(1 << Interrupt | 1 << Break)));
+		PC += 2;
+		push(splat(PC >> 8));
+		push(splat((uint8_t)PC));
+		push(load(SF));
+
+		PC = rom(0xFFFA) + (rom(0xFFFB) << 8);
+	}
+	void RTI() {
+		for (int i = 0; i < Lanes; i++) SF[i] = pull(i) & 0xCF;
+		RTS();
+	}
+
+	// Miscellaneous
+	void BIT(uint8_t mode) {
+		__m128i value = readMem(mode);
+		store(SF, _mm_or_si128(load(SF), _mm_and_si128(value, splat(0xC0))));
+		__m128i zero = _mm_cmpeq_epi8(_mm_and_si128(value, load(ACC)), _mm_setzero_si128());
+		setFlags(1 << Zero, _mm_andnot_si128(zero, splat(1 << Zero)));
+	}
+	void NOP() {
+		PC++;
+	}
+};
@@ -0,0 +1,65 @@
+#pragma once
+
+#include <cctype>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include "MemMap.h"
+
+// Cheat Codes
+// Decodes Game Genie codes and raw patches into MemMap patches:
+//   Game Genie  6 letters (address, value) or 8 (address, compare, value)
+//   Raw         AAAA:VV or AAAA?CC:VV, hex, any address outside the registers
+class Cheats {
+public:
+	struct Code {
+		uint16_t addr;
+		int compare;	// -1 for none
+		uint8_t value;
+	};
+
+	static bool decode(const std::string& text, Code& code) {
+		static const char letters[] = "APZLGITYEOXUKSVN";
+		code.compare = -1;
+
+		if (text.find(':') != std::string::npos) {
+			// raw
+			char* end;
+			unsigned long addr = strtoul(text.c_str(), &end, 16);
+			if (*end == '?') {
+				code.compare = (int)strtoul(end + 1, &end, 16);
+				if (code.compare > 0xFF) return false;
+			}
+			if (*end != ':' || addr > 0xFFFF || (addr >= 0x2000 && addr < 0x4020)) return false;
+			unsigned long value = strtoul(end + 1, &end, 16);
+			if (*end || value > 0xFF) return false;
+			code.addr = (uint16_t)addr;
+			code.value = (uint8_t)value;
+			return true;
+		}
+
+		if (text.size() != 6 && text.size() != 8) return false;
+		int n[8];
+		for (size_t i = 0; i < text.size(); i++) {
+			const char* letter = strchr(letters, toupper((unsigned char)text[i]));
+			if (!letter || !*letter) return false;
+			n[i] = (int)(letter - letters);
+		}
+		code.addr = 0x8000 | ((n[3] & 7) << 12) | ((n[5] & 7) << 8) | ((n[4] & 8) << 8) | ((n[2] & 7) << 4) | ((n[1] & 8) << 4) | (n[4] & 7) | (n[3] & 8);
+		if (text.size() == 6) code.value = (uint8_t)(((n[1] & 7) << 4) | ((n[0] & 8) << 4) | (n[0] & 7) | (n[5] & 8));
+		else {
+			code.value = (uint8_t)(((n[1] & 7) << 4) | ((n[0] & 8) << 4) | (n[0] & 7) | (n[7] & 8));
+			code.compare = ((n[7] & 7) << 4) | ((n[6] & 8) << 4) | (n[6] & 7) | (n[5] & 8);
+		}
+		return true;
+	}
+	static int apply(MemMap* mem, const std::string& text) {
+		// patch id, or 0 for a code that does not decode
+		Code code;
+		if (!decode(text, code)) {
+			printf("\nError: %s is not a cheat code\n", text.c_str());
+			return 0;
+		}
+		return mem->addPatch(code.addr, code.value, code.compare);
+	}
+};
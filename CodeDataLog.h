@@ -0,0 +1,113 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <vector>
+
+// Code/Data Log (.nesc)
+//   "NESC", version, PRG size (32 bit, native order), then the code, operand
+//   and data bitmaps, one bit per PRG byte, 64 bit words
+// Records how each PRG ROM byte has been used: fetched as an opcode, read
+// as an instruction operand, or read as data. Bitmaps are indexed by ROM
+// offset, so each 8KB bank owns a contiguous 1KB of every plane whatever
+// window it was mapped into. Logs from parallel runs of the same ROM merge
+// by OR.
+class CodeDataLog {
+public:
+	enum use {
+		Code, Operand, Data, Uses
+	};
+	static const size_t BankSize = 0x2000;
+
+private:
+	std::vector<uint64_t> planes[Uses];
+	uint32_t size = 0;	// PRG bytes covered
+
+public:
+	// Recording
+	void resize(size_t prgSize) {
+		// a log only covers one ROM; a different size starts it afresh
+		if (prgSize == size) return;
+		size = (uint32_t)prgSize;
+		for (auto& plane : planes) plane.assign((size + 63) / 64, 0);
+	}
+	void clear() {
+		for (auto& plane : planes) std::fill(plane.begin(), plane.end(), 0);
+	}
+	void mark(size_t offset, int how) {
+		planes[how][offset >> 6] |= 1ull << (offset & 63);
+	}
+	bool marked(size_t offset, int how) {
+		return (planes[how][offset >> 6] >> (offset & 63)) & 1;
+	}
+	bool merge(const CodeDataLog& other) {
+		if (other.size != size) {
+			printf("\nError: cannot merge logs of %u and %u byte ROMs\n", other.size, size);
+			return false;
+		}
+		for (int how = 0; how < Uses; how++) {
+			for (size_t i = 0; i < planes[how].size(); i++) planes[how][i] |= other.planes[how][i];
+		}
+		return true;
+	}
+
+	// Coverage
+	size_t banks() {
+		return (size + BankSize - 1) / BankSize;
+	}
+	size_t count(int how, size_t bank) {
+		// bytes of the bank marked with this use
+		size_t total = 0;
+		for (size_t i = bank * BankSize / 64; i < (bank + 1) * BankSize / 64 && i < planes[how].size(); i++) total += popcount(planes[how][i]);
+		return total;
+	}
+	size_t untouched(size_t bank) {
+		size_t total = 0;
+		for (size_t i = bank * BankSize / 64; i < (bank + 1) * BankSize / 64 && i < planes[Code].size(); i++) total += 64 - popcount(planes[Code][i] | planes[Operand][i] | planes[Data][i]);
+		return total;
+	}
+	static int popcount(uint64_t bits) {
+		int total = 0;
+		for (; bits; bits &= bits - 1) total++;
+		return total;
+	}
+
+	// File Access
+	bool load(const char* path) {
+		std::ifstream file(path, std::ios::binary);
+		char magic[5];
+		uint32_t prgSize = 0;
+		file.read(magic, 5);
+		file.read((char*)&prgSize, 4);
+		if (!file || memcmp(magic, "NESC\1", 5)) {
+			printf("\nError: %s is not a code/data log\n", path);
+			return false;
+		}
+		size = 0;
+		resize(prgSize);
+		for (auto& plane : planes) file.read((char*)plane.data(), plane.size() * 8);
+		if (!file) {
+			printf("\nError: %s is truncated\n", path);
+			return false;
+		}
+		return true;
+	}
+	bool save(const char* path) {
+		std::ofstream file(path, std::ios::binary);
+		file.write("NESC\1", 5);
+		file.write((char*)&size, 4);
+		for (auto& plane : planes) file.write((char*)plane.data(), plane.size() * 8);
+		return (bool)file;
+	}
+	bool exportCDL(const char* path) {
+		// FCEUX layout, one byte per PRG byte: bit 0 code, bit 1 data
+		std::ofstream file(path, std::ios::binary);
+		std::vector<uint8_t> bytes(size);
+		for (uint32_t i = 0; i < size; i++) bytes[i] = (marked(i, Code) || marked(i, Operand)) | (marked(i, Data) << 1);
+		file.write((char*)bytes.data(), bytes.size());
+		return (bool)file;
+	}
+};
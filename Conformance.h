@@ -0,0 +1,388 @@
+#pragma once
+
+#include <atomic>
+#include <cstdlib>
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <thread>
+#include "CPU.h"
+
+// CPU Conformance Vectors
+// Single instruction tests in the SingleStepTests/ProcessorTests layout: a
+// JSON array of { "name", "initial", "final", "cycles" }, where a state is
+// { "pc", "s", "a", "x", "y", "p", "ram": [[addr, value], ...] } and cycles
+// is [[addr, value, "read" | "write"], ...].
+// Packed form (.nesx), for loading large sets quickly:
+//   "NESX", version, vector count (32 bit, native order), then per vector:
+//   name length (16 bit), name, initial state, final state, cycle count
+//   (16 bit), cycles; a state is pc (16 bit), s, a, x, y, p, RAM entry
+//   count (16 bit), then address (16 bit) and value per entry.
+// Each vector runs one instruction on the accurate core against the flat
+// test bus, in parallel, and is checked for registers, RAM, cycle count and
+// optionally the exact bus accesses.
+class Conformance {
+public:
+	struct CPUState {
+		uint16_t pc = 0;
+		uint8_t s = 0, a = 0, x = 0, y = 0, p = 0;
+		std::vector<std::pair<uint16_t, uint8_t>> ram;
+	};
+	struct Vector {
+		std::string name;
+		CPUState initial;
+		CPUState final;
+		std::vector<BusCycle> cycles;
+	};
+	struct Failure {
+		size_t vector;
+		std::string diff;
+	};
+
+private:
+	std::vector<Vector> vectors;
+
+	// JSON Reading
+	// Just enough JSON for the vector layout; unknown keys are skipped.
+	class Json {
+		const std::string& text;
+		size_t at = 0;
+
+	public:
+		bool ok = true;
+
+		Json(const std::string& source) : text(source) {}
+		char peek() {
+			while (at < text.size() && isspace((unsigned char)text[at])) at++;
+			return at < text.size() ? text[at] : 0;
+		}
+		bool take(char c) {
+			if (peek() != c) return false;
+			at++;
+			return true;
+		}
+		void expect(char c) {
+			if (!take(c)) ok = false;
+		}
+		long number() {
+			peek();
+			char* end;
+			long value = strtol(text.c_str() + at, &end, 10);
+			if (end == text.c_str() + at) ok = false;
+			at = end - text.c_str();
+			return value;
+		}
+		std::string string() {
+			std::string value;
+			expect('"');
+			while (ok && at < text.size() && text[at] != '"') {
+				if (text[at] == '\\') at++;
+				value += text[at++];
+			}
+			expect('"');
+			return value;
+		}
+		void skip() {
+			// any value
+			char c = peek();
+			if (c == '"') string();
+			else if (c == '{' || c == '[') {
+				at++;
+				char close = c == '{' ? '}' : ']';
+				while (ok && !take(close)) {
+					if (c == '{') {
+						string();
+						expect(':');
+					}
+					skip();
+					take(',');
+					if (at >= text.size()) ok = false;
+				}
+			}
+			else {
+				while (at < text.size() && !strchr(",}] \t\r\n", text[at])) at++;
+			}
+		}
+		bool more(char close) {
+			// true while the array or object has entries left
+			if (take(close)) return false;
+			take(',');
+			if (take(close)) return false;
+			return ok && at < text.size();
+		}
+	};
+	static void readState(Json& json, CPUState& state) {
+		json.expect('{');
+		while (json.more('}')) {
+			std::string key = json.string();
+			json.expect(':');
+			if (key == "pc") state.pc = (uint16_t)json.number();
+			else if (key == "s") state.s = (uint8_t)json.number();
+			else if (key == "a") state.a = (uint8_t)json.number();
+			else if (key == "x") state.x = (uint8_t)json.number();
+			else if (key == "y") state.y = (uint8_t)json.number();
+			else if (key == "p") state.p = (uint8_t)json.number();
+			else if (key == "ram") {
+				json.expect('[');
+				while (json.more(']')) {
+					json.expect('[');
+					uint16_t addr = (uint16_t)json.number();
+					json.expect(',');
+					state.ram.push_back({ addr, (uint8_t)json.number() });
+					json.expect(']');
+				}
+			}
+			else json.skip();
+		}
+	}
+	static void readCycles(Json& json, std::vector<BusCycle>& cycles) {
+		json.expect('[');
+		while (json.more(']')) {
+			json.expect('[');
+			BusCycle cycle;
+			cycle.addr = (uint16_t)json.number();
+			json.expect(',');
+			cycle.value = (uint8_t)json.number();
+			json.expect(',');
+			cycle.write = json.string() == "write";
+			json.expect(']');
+			cycles.push_back(cycle);
+		}
+	}
+	bool loadJson(const char* path, const std::string& text) {
+		Json json(text);
+		json.expect('[');
+		while (json.more(']')) {
+			vectors.emplace_back();
+			Vector& vector = vectors.back();
+			json.expect('{');
+			while (json.more('}')) {
+				std::string key = json.string();
+				json.expect(':');
+				if (key == "name") vector.name = json.string();
+				else if (key == "initial") readState(json, vector.initial);
+				else if (key == "final") readState(json, vector.final);
+				else if (key == "cycles") readCycles(json, vector.cycles);
+				else json.skip();
+			}
+		}
+		if (!json.ok) printf("\nError: %s is not a vector file\n", path);
+		return json.ok;
+	}
+
+	// Packed Form
+	template <typename T>
+	static void put(std::ofstream& file, T value) {
+		file.write((char*)&value, sizeof(T));
+	}
+	template <typename T>
+	static T get(std::ifstream& file) {
+		T value = 0;
+		file.read((char*)&value, sizeof(T));
+		return value;
+	}
+	static void putState(std::ofstream& file, const CPUState& state) {
+		put(file, state.pc);
+		uint8_t regs[5] = { state.s, state.a, state.x, state.y, state.p };
+		file.write((char*)regs, 5);
+		put(file, (uint16_t)state.ram.size());
+		for (auto& entry : state.ram) {
+			put(file, entry.first);
+			put(file, entry.second);
+		}
+	}
+	static void getState(std::ifstream& file, CPUState& state) {
+		state.pc = get<uint16_t>(file);
+		uint8_t regs[5];
+		file.read((char*)regs, 5);
+		state.s = regs[0];
+		state.a = regs[1];
+		state.x = regs[2];
+		state.y = regs[3];
+		state.p = regs[4];
+		state.ram.resize(get<uint16_t>(file));
+		for (auto& entry : state.ram) {
+			entry.first = get<uint16_t>(file);
+			entry.second = get<uint8_t>(file);
+		}
+	}
+	bool loadPacked(const char* path) {
+		std::ifstream file(path, std::ios::binary);
+		char magic[5];
+		file.read(magic, 5);
+		uint32_t count = get<uint32_t>(file);
+		if (!file || memcmp(magic, "NESX\1", 5)) {
+			printf("\nError: %s is not a packed vector file\n", path);
+			return false;
+		}
+		size_t first = vectors.size();
+		vectors.resize(first + count);
+		for (size_t i = first; i < vectors.size() && file; i++) {
+			Vector& vector = vectors[i];
+			vector.name.resize(get<uint16_t>(file));
+			file.read(&vector.name[0], vector.name.size());
+			getState(file, vector.initial);
+			getState(file, vector.final);
+			vector.cycles.resize(get<uint16_t>(file));
+			for (BusCycle& cycle : vector.cycles) {
+				cycle.addr = get<uint16_t>(file);
+				cycle.value = get<uint8_t>(file);
+				cycle.write = get<uint8_t>(file) != 0;
+			}
+		}
+		if (!file) {
+			printf("\nError: %s is truncated\n", path);
+			return false;
+		}
+		return true;
+	}
+
+	// Checking
+	static void compare(std::string& diff, const char* what, int expected, int got) {
+		if (expected == got) return;
+		char line[64];
+		snprintf(line, sizeof(line), "\n    %s: expected %02x, got %02x", what, expected, got);
+		diff += line;
+	}
+	static std::string run(const Vector& vector, MemMap* bus, CPU* cpu, bool checkBus) {
+		uint8_t* ram = bus->flatMemory();
+		for (auto& entry : vector.initial.ram) ram[entry.first] = entry.second;
+
+		State state;
+		cpu->saveState(state);
+		state.PC = vector.initial.pc;
+		state.SP = vector.initial.s;
+		state.ACC = vector.initial.a;
+		state.X = vector.initial.x;
+		state.Y = vector.initial.y;
+		state.SF = vector.initial.p;
+		state.cycle = 0;
+		cpu->loadState(state);
+		bus->clearBusCycles();
+		cpu->execute();
+		cpu->saveState(state);
+
+		std::string diff;
+		compare(diff, "PC", vector.final.pc, state.PC);
+		compare(diff, "S", vector.final.s, state.SP);
+		compare(diff, "A", vector.final.a, state.ACC);
+		compare(diff, "X", vector.final.x, state.X);
+		compare(diff, "Y", vector.final.y, state.Y);
+		compare(diff, "P", vector.final.p, state.SF);
+		char what[16];
+		for (auto& entry : vector.final.ram) {
+			snprintf(what, sizeof(what), "$%04X", entry.first);
+			compare(diff, what, entry.second, ram[entry.first]);
+		}
+		compare(diff, "cycles", (int)vector.cycles.size(), (int)state.cycle);
+
+		const std::vector<BusCycle>& log = bus->busCycles();
+		if (checkBus) {
+			for (size_t i = 0; i < vector.cycles.size() || i < log.size(); i++) {
+				const BusCycle* want = i < vector.cycles.size() ? &vector.cycles[i] : nullptr;
+				const BusCycle* got = i < log.size() ? &log[i] : nullptr;
+				if (want && got && want->addr == got->addr && want->value == got->value && want->write == got->write) continue;
+				char line[96];
+				snprintf(line, sizeof(line), "\n    bus cycle %zu: expected %s, got %s", i, describe(want).c_str(), describe(got).c_str());
+				diff += line;
+				break;
+			}
+		}
+
+		// leave the bus zeroed for the next vector
+		for (auto& entry : vector.initial.ram) ram[entry.first] = 0;
+		for (auto& entry : vector.final.ram) ram[entry.first] = 0;
+		for (const BusCycle& cycle : log) ram[cycle.addr] = 0;
+		return diff;
+	}
+	static std::string describe(const BusCycle* cycle) {
+		if (!cycle) return "nothing";
+		char text[32];
+		snprintf(text, sizeof(text), "%s $%04X = %02x", cycle->write ? "write" : "read", cycle->addr, cycle->value);
+		return text;
+	}
+
+public:
+	// File Access
+	bool load(const char* path) {
+		// JSON or packed, by content
+		std::ifstream file(path, std::ios::binary);
+		if (!file) {
+			printf("\nError: cannot open %s\n", path);
+			return false;
+		}
+		std::string text((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+		if (text.compare(0, 4, "NESX") == 0) return loadPacked(path);
+		return loadJson(path, text);
+	}
+	bool save(const char* path) {
+		std::ofstream file(path, std::ios::binary);
+		file.write("NESX\1", 5);
+		put(file, (uint32_t)vectors.size());
+		for (const Vector& vector : vectors) {
+			put(file, (uint16_t)vector.name.size());
+			file.write(vector.name.data(), vector.name.size());
+			putState(file, vector.initial);
+			putState(file, vector.final);
+			put(file, (uint16_t)vector.cycles.size());
+			for (const BusCycle& cycle : vector.cycles) {
+				put(file, cycle.addr);
+				put(file, cycle.value);
+				put(file, (uint8_t)cycle.write);
+			}
+		}
+		return (bool)file;
+	}
+	size_t count() {
+		return vectors.size();
+	}
+	const Vector& vector(size_t index) {
+		return vectors[index];
+	}
+
+	// Checking
+	// Runs every vector across threads, each with its own test bus and
+	// accurate core. Failures come back in vector order.
+	std::vector<Failure> check(bool checkBus, unsigned int threads = 0) {
+		if (threads == 0) threads = std::thread::hardware_concurrency();
+		if (threads == 0) threads = 1;
+
+		std::vector<std::string> diffs(vectors.size());
+		std::atomic<size_t> next(0);
+		auto worker = [&]() {
+			std::unique_ptr<MemMap> bus(MemMap::createFlat());
+			std::unique_ptr<CPU> cpu(CPU::create(bus.get(), nullptr, true));
+			for (size_t i = next++; i < vectors.size(); i = next++) diffs[i] = run(vectors[i], bus.get(), cpu.get(), checkBus);
+		};
+
+		std::vector<std::thread> pool;
+		for (unsigned int i = 0; i < threads; i++) pool.emplace_back(worker);
+		for (std::thread& thread : pool) thread.join();
+
+		std::vector<Failure> failures;
+		for (size_t i = 0; i < diffs.size(); i++) {
+			if (!diffs[i].empty()) failures.push_back({ i, diffs[i] });
+		}
+		return failures;
+	}
+
+	void test() {
+		// Conformance.json holds hand checked vectors for the internal
+		// cycles: stack pulls, indexed zero page, page crossings, RMW and
+		// taken branches
+		std::cout << "\nTesting Conformance:";
+
+		int err_cnt = 0;
+		if (!load("Conformance.json") || vectors.empty()) err_cnt++;
+		else {
+			for (const Failure& failure : check(true)) {
+				printf("\n  %s:%s", vectors[failure.vector].name.c_str(), failure.diff.c_str());
+				err_cnt++;
+			}
+		}
+		vectors.clear();
+
+		if (err_cnt == 0) std::cout << "\nConformance OK\n";
+		else printf("\nConformance NOT OK: %d errors found\n", err_cnt);
+	}
+};
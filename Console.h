@@ -0,0 +1,85 @@
+#pragma once
+
+#include "CPU.h"
+
+// One emulated machine with its own memory map and CPU, for running many jobs side by side
+class Console {
+private:
+	// Instance Block
+	// CPU registers and the memory map (page tables, PPU, I/O state) share
+	// one cache line aligned block from a process-wide arena; RAM pages come
+	// from MemMap's page pool.
+	static const size_t memOffset = (sizeof(CPU) + Arena::Line - 1) & ~(Arena::Line - 1);
+	static Arena& arena() {
+		static Arena* blocks = new Arena(memOffset + sizeof(MemMap), 64);
+		return *blocks;
+	}
+	uint8_t* block = (uint8_t*)arena().allocate();
+
+	Console(Console* parent) : mem(parent->mem->fork(block + memOffset)), cpu(parent->cpu->fork(mem, block)) {}
+
+public:
+	MemMap* mem = MemMap::create(block + memOffset);
+	CPU* cpu = CPU::create(mem, block);
+
+	Console() {}
+	explicit Console(bool accurate) : cpu(CPU::create(mem, block, accurate)) {}
+	Console(const Console&) = delete;
+	Console& operator=(const Console&) = delete;
+	~Console() {
+		cpu->~CPU();
+		mem->~MemMap();
+		arena().release(block);
+	}
+
+	// Instance Pools
+	static void reserve(size_t count, bool hugePages) {
+		// maps room for count consoles up front, optionally on huge pages
+		arena().useHugePages(hugePages);
+		arena().reserve(count);
+		MemMap::reservePages(count * 8, hugePages);
+	}
+
+	// Emulator Utilities
+	bool powerOn(const char* romPath) {
+		mem->clear();
+		if (!mem->loadROM(romPath)) return false;
+		cpu->reset();
+		return true;
+	}
+	bool powerOn(std::shared_ptr<const RomImage> image) {
+		// an image already loaded, e.g. the one a keyframe file is bound to
+		if (!image) return false;
+		mem->clear();
+		mem->mapROM(image);
+		cpu->reset();
+		return true;
+	}
+	Console* fork() {
+		// near free branch: memory pages stay shared until either side writes them
+		return new Console(this);
+	}
+	void saveState(State& state) {
+		cpu->saveState(state);
+		mem->saveState(state);
+	}
+	void loadState(const State& state) {
+		cpu->loadState(state);
+		mem->loadState(state);
+	}
+	void renderFrame(Frame& frame) {
+		// palette-indexed; headless runs never call this
+		mem->render(frame);
+	}
+	uint64_t hash() {
+		return hashFinal(mem->hash(cpu->hash()));
+	}
+	uint64_t stateHash() {
+		// whole machine (hash() covers CPU and RAM only), incremental
+		return hashFinal(mem->stateHash(cpu->stateHash()));
+	}
+	bool sameState(Console& other) {
+		// different hashes settle most comparisons without touching memory
+		return stateHash() == other.stateHash() && cpu->sameState(*other.cpu) && mem->sameState(*other.mem);
+	}
+};
@@ -0,0 +1,48 @@
+#pragma once
+
+#include <cstdint>
+
+class Controller {
+private:
+	// Standard Joypad
+	uint8_t buttons = 0;	// Live button state
+	uint8_t shift = 0;		// Serial shift register
+	bool strobe = false;	// Reload shift register while set
+
+public:
+	enum button {
+		A, B, Select, Start, Up, Down, Left, Right
+	};
+
+	// Emulator Utilities
+	void clear() {
+		buttons = 0;
+		shift = 0;
+		strobe = false;
+	}
+	void setButtons(uint8_t value) {
+		buttons = value;
+		if (strobe) shift = buttons;
+	}
+	uint8_t getButtons() {
+		return buttons;
+	}
+	uint32_t pack() const {
+		// whole state, for hashing and comparing
+		return buttons | shift << 8 | strobe << 16;
+	}
+
+	// Port Access ($4016 / $4017)
+	void write(uint8_t value) {
+		strobe = value & 0x01;
+		if (strobe) shift = buttons;
+	}
+	uint8_t read() {
+		if (strobe) return buttons & 0x01;
+
+		// report A, B, Select, Start, Up, Down, Left, Right, then 1's
+		uint8_t bit = shift & 0x01;
+		shift = (shift >> 1) | 0x80;
+		return bit;
+	}
+};
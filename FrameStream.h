@@ -0,0 +1,275 @@
+#pragma once
+
+#include <emmintrin.h>
+#include <condition_variable>
+#include <cstdio>
+#include <deque>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include "PPU.h"
+#include "RunLength.h"
+
+// Frame Stream (.nesv)
+//   "NESV", version, reserved, width, height (16 bit, native order),
+//   then per frame: emphasis, changed row count (16 bit), and per changed
+//   row: row number, packed length (16 bit), row XOR previous frame's row
+//   packed with RunLength.h.
+// Unchanged rows cost nothing and a changed row is mostly zeros after the
+// XOR, so a typical frame is a few hundred bytes instead of 61440.
+
+// Writes palette-indexed frames on a background thread
+class FrameWriter {
+private:
+	static const size_t Depth = 8;	// Frames queued before push() waits
+
+	std::ofstream file;
+	std::thread worker;
+	std::mutex lock;
+	std::condition_variable ready;	// Frame queued or closing
+	std::condition_variable space;	// Frame written
+	std::deque<std::unique_ptr<Frame>> queue;
+	std::vector<std::unique_ptr<Frame>> spare;
+	std::unique_ptr<Frame> previous;
+	bool closing = false;
+	uint32_t frames = 0;
+	uint64_t written = 0;
+
+	static bool rowChanged(const uint8_t* row, const uint8_t* last) {
+		__m128i diff = _mm_setzero_si128();
+		for (int x = 0; x < Frame::Width; x += 16) {
+			__m128i a = _mm_loadu_si128((const __m128i*)(row + x));
+			__m128i b = _mm_loadu_si128((const __m128i*)(last + x));
+			diff = _mm_or_si128(diff, _mm_xor_si128(a, b));
+		}
+		return _mm_movemask_epi8(_mm_cmpeq_epi8(diff, _mm_setzero_si128())) != 0xFFFF;
+	}
+	void encode(const Frame& frame, std::vector<uint8_t>& out) {
+		out.clear();
+		out.push_back(frame.emphasis);
+		out.push_back(0);
+		out.push_back(0);
+
+		uint16_t rows = 0;
+		uint8_t delta[Frame::Width];
+		for (int y = 0; y < Frame::Height; y++) {
+			const uint8_t* row = frame.pixels[y];
+			const uint8_t* last = previous->pixels[y];
+			if (!rowChanged(row, last)) continue;
+			for (int x = 0; x < Frame::Width; x += 16) {
+				__m128i a = _mm_loadu_si128((const __m128i*)(row + x));
+				__m128i b = _mm_loadu_si128((const __m128i*)(last + x));
+				_mm_storeu_si128((__m128i*)(delta + x), _mm_xor_si128(a, b));
+			}
+
+			size_t start = out.size();
+			out.push_back((uint8_t)y);
+			out.push_back(0);
+			out.push_back(0);
+			packRuns(delta, Frame::Width, out);
+			uint16_t len = (uint16_t)(out.size() - start - 3);
+			memcpy(&out[start + 1], &len, 2);
+			rows++;
+		}
+		memcpy(&out[1], &rows, 2);
+	}
+	void run() {
+		std::vector<uint8_t> packed;
+		std::unique_lock<std::mutex> guard(lock);
+		while (true) {
+			ready.wait(guard, [this] { return closing || !queue.empty(); });
+			if (queue.empty()) return;
+			std::unique_ptr<Frame> frame = std::move(queue.front());
+			queue.pop_front();
+			guard.unlock();
+
+			encode(*frame, packed);
+			file.write((char*)packed.data(), packed.size());
+			std::swap(previous, frame);
+
+			guard.lock();
+			written += packed.size();
+			spare.push_back(std::move(frame));
+			space.notify_one();
+		}
+	}
+
+public:
+	FrameWriter() {}
+	FrameWriter(const FrameWriter&) = delete;
+	FrameWriter& operator=(const FrameWriter&) = delete;
+	~FrameWriter() {
+		close();
+	}
+
+	// File Access
+	bool open(const char* path) {
+		close();
+		file.open(path, std::ios::binary);
+		if (!file) {
+			printf("\nError: cannot create frame stream %s\n", path);
+			return false;
+		}
+		uint16_t size[2] = { Frame::Width, Frame::Height };
+		file.write("NESV\1\0", 6);
+		file.write((char*)size, 4);
+
+		previous.reset(new Frame());
+		closing = false;
+		frames = 0;
+		written = 10;
+		worker = std::thread(&FrameWriter::run, this);
+		return true;
+	}
+	bool close() {
+		// drains the queue; false if anything failed to write
+		if (!worker.joinable()) return true;
+		{
+			std::lock_guard<std::mutex> guard(lock);
+			closing = true;
+		}
+		ready.notify_one();
+		worker.join();
+		bool ok = (bool)file;
+		file.close();
+		return ok;
+	}
+
+	// Frame Output
+	void push(const Frame& frame) {
+		// copies the frame and returns; encoding and disk I/O stay off the
+		// emulation thread unless the queue is full
+		std::unique_lock<std::mutex> guard(lock);
+		space.wait(guard, [this] { return queue.size() < Depth; });
+		std::unique_ptr<Frame> copy;
+		if (spare.empty()) copy.reset(new Frame());
+		else {
+			copy = std::move(spare.back());
+			spare.pop_back();
+		}
+		*copy = frame;
+		queue.push_back(std::move(copy));
+		frames++;
+		ready.notify_one();
+	}
+	uint32_t frameCount() {
+		return frames;
+	}
+	uint64_t bytesWritten() {
+		std::lock_guard<std::mutex> guard(lock);
+		return written;
+	}
+};
+
+// Reads a frame stream back one frame at a time
+class FrameReader {
+private:
+	std::ifstream file;
+	std::vector<uint8_t> packed;
+
+public:
+	// File Access
+	bool open(const char* path) {
+		file.open(path, std::ios::binary);
+		char magic[6];
+		uint16_t size[2];
+		file.read(magic, 6);
+		file.read((char*)size, 4);
+		if (!file || memcmp(magic, "NESV\1", 5)) {
+			printf("\nError: %s is not a frame stream\n", path);
+			return false;
+		}
+		if (size[0] != Frame::Width || size[1] != Frame::Height) {
+			printf("\nError: %s has %dx%d frames\n", path, size[0], size[1]);
+			return false;
+		}
+		return true;
+	}
+
+	// Frame Input
+	// frame must hold the previous frame (zeroed before the first call).
+	// Returns false at the end of the stream or on a damaged record.
+	bool next(Frame& frame) {
+		uint8_t header[3];
+		if (!file.read((char*)header, 3)) return false;
+		uint16_t rows;
+		memcpy(&rows, header + 1, 2);
+		frame.emphasis = header[0];
+
+		uint8_t delta[Frame::Width];
+		for (uint16_t i = 0; i < rows; i++) {
+			uint8_t row[3];
+			uint16_t len;
+			if (!file.read((char*)row, 3)) return false;
+			memcpy(&len, row + 1, 2);
+			packed.resize(len);
+			if (row[0] >= Frame::Height || !file.read((char*)packed.data(), len)) return false;
+			if (!unpackRuns(packed.data(), len, delta, Frame::Width)) return false;
+			uint8_t* pixels = frame.pixels[row[0]];
+			for (int x = 0; x < Frame::Width; x++) pixels[x] ^= delta[x];
+		}
+		return true;
+	}
+
+	void test() {
+		std::cout << "\nTesting Frame Stream:";
+
+		// More frames than the writer queues, mixing repeats, single pixel
+		// changes, emphasis only changes and whole new pictures
+		const uint32_t count = 3 * 8;
+		std::vector<std::unique_ptr<Frame>> frames;
+		std::unique_ptr<Frame> frame(new Frame());
+		for (uint32_t i = 0; i < count; i++) {
+			if (i % 6 == 1) frame->pixels[i * 7][i * 11] ^= 0x2A;
+			else if (i % 6 == 2) frame->emphasis = (uint8_t)(i & 0x07);
+			else if (i % 6 == 3) {
+				for (int y = 0; y < Frame::Height; y++) {
+					for (int x = 0; x < Frame::Width; x++) frame->pixels[y][x] = (uint8_t)((x ^ y) * i & 0x3F);
+				}
+			}
+			else if (i % 6 == 4) frame->pixels[Frame::Height - 1][Frame::Width - 1]++;
+			frames.emplace_back(new Frame(*frame));
+		}
+
+		const char* path = "Frame Stream test.nesv";
+		FrameWriter writer;
+		writer.open(path);
+		for (auto& source : frames) writer.push(*source);
+		bool written = writer.close();
+
+		int err_cnt = 0;
+		std::cout << "\n  Round trip: ";{
+			FrameReader reader;
+			std::unique_ptr<Frame> decoded(new Frame());
+			uint32_t read = 0, wrong = 0;
+			if (reader.open(path)) {
+				while (read < count + 1 && reader.next(*decoded)) {
+					if (read >= count || decoded->emphasis != frames[read]->emphasis || memcmp(decoded->pixels, frames[read]->pixels, sizeof(decoded->pixels))) wrong++;
+					read++;
+				}
+			}
+			if (written && writer.frameCount() == count && read == count && wrong == 0) std::cout << "OK";
+			else {
+				printf("Error: %u of %u frames read back, %u differ", read, count, wrong);
+				err_cnt++;
+			}
+		}
+		std::cout << "\n  Size: ";{
+			// repeated frames cost only their 3 byte header
+			std::ifstream in(path, std::ios::binary | std::ios::ate);
+			uint64_t size = (uint64_t)in.tellg();
+			uint64_t raw = (uint64_t)count * Frame::Width * Frame::Height;
+			if (size == writer.bytesWritten() && size * 4 < raw) std::cout << "OK";
+			else {
+				printf("Error: %llu bytes on disk, %llu counted", (unsigned long long)size, (unsigned long long)writer.bytesWritten());
+				err_cnt++;
+			}
+		}
+		std::remove(path);
+
+		if (err_cnt == 0) std::cout << "\nFrame Stream OK\n";
+		else printf("\nFrame Stream NOT OK: %d errors found\n", err_cnt);
+	}
+};
@@ -0,0 +1,37 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+
+// Fast 64-bit state hash for desync detection (not cryptographic)
+const uint64_t hashSeed = 0xCBF29CE484222325;
+
+inline uint64_t hashMix(uint64_t h, uint64_t value) {
+	h ^= value;
+	h *= 0x9E3779B97F4A7C15;
+	return h ^ (h >> 29);
+}
+inline uint64_t hashWords(const uint8_t* data, size_t len, uint64_t h) {
+	// consume 8 bytes per step; len must be a multiple of 8
+	for (size_t i = 0; i < len; i += 8) {
+		uint64_t word;
+		memcpy(&word, data + i, 8);
+		h = hashMix(h, word);
+	}
+	return h;
+}
+inline uint64_t hashBytes(const uint8_t* data, size_t len, uint64_t h = hashSeed) {
+	// whole words, then the tail
+	size_t words = len & ~(size_t)7;
+	h = hashWords(data, words, h);
+	uint64_t tail = len;
+	for (size_t i = words; i < len; i++) tail = (tail << 8) | data[i];
+	return hashMix(h, tail);
+}
+inline uint64_t hashFinal(uint64_t h) {
+	h ^= h >> 33;
+	h *= 0xFF51AFD7ED558CCD;
+	h ^= h >> 33;
+	h *= 0xC4CEB9FE1A85EC53;
+	return h ^ (h >> 33);
+}
@@ -0,0 +1,180 @@
+#pragma once
+
+#include <atomic>
+#include <thread>
+#include "Movie.h"
+
+// Keyframe File (.nesk)
+//   "NESK", version, interval, keyframe count (32 bit, native order),
+//   ROM hash (64 bit), ROM path length (32 bit) and path,
+//   then per keyframe: frame, state hash, raw State
+// A State holds no ROM, so keyframes are bound to the ROM they were
+// recorded from and restored only into a console running it.
+class Keyframes {
+private:
+	struct Keyframe {
+		uint32_t frame;	// Frames completed
+		uint64_t hash;	// Console::hash() of state
+		State state;
+	};
+	uint32_t interval = 0;
+	std::vector<Keyframe> keys;
+	std::string romPath;
+	std::shared_ptr<const RomImage> rom;
+
+public:
+	struct Segment {
+		uint32_t first;	// Keyframe the segment starts from
+		uint32_t last;	// Keyframe it must reach
+		bool ok;
+	};
+
+	// File Access
+	bool load(const char* path) {
+		std::ifstream file(path, std::ios::binary);
+		char magic[5];
+		uint32_t count = 0, pathLength = 0;
+		uint64_t romHash = 0;
+		file.read(magic, 5);
+		file.read((char*)&interval, 4);
+		file.read((char*)&count, 4);
+		file.read((char*)&romHash, 8);
+		file.read((char*)&pathLength, 4);
+		if (!file || magic[0] != 'N' || magic[1] != 'E' || magic[2] != 'S' || magic[3] != 'K' || magic[4] != 2 || pathLength > 0x1000) {
+			printf("\nError: %s is not a keyframe file\n", path);
+			return false;
+		}
+		romPath.resize(pathLength);
+		file.read(&romPath[0], pathLength);
+		rom = RomCache::getInstance()->load(romPath.c_str());
+		if (!rom) return false;
+		if (rom->hash != romHash) {
+			printf("\nError: %s was recorded from a different %s\n", path, romPath.c_str());
+			return false;
+		}
+
+		keys.resize(count);
+		for (Keyframe& key : keys) {
+			file.read((char*)&key.frame, 4);
+			file.read((char*)&key.hash, 8);
+			file.read((char*)&key.state, sizeof(State));
+		}
+		if (!file) {
+			printf("\nError: %s is truncated\n", path);
+			return false;
+		}
+		return true;
+	}
+	bool save(const char* path) {
+		std::ofstream file(path, std::ios::binary);
+		uint32_t count = (uint32_t)keys.size();
+		uint32_t pathLength = (uint32_t)romPath.size();
+		uint64_t romHash = rom ? rom->hash : 0;
+		file.write("NESK\2", 5);
+		file.write((char*)&interval, 4);
+		file.write((char*)&count, 4);
+		file.write((char*)&romHash, 8);
+		file.write((char*)&pathLength, 4);
+		file.write(romPath.data(), pathLength);
+		for (Keyframe& key : keys) {
+			file.write((char*)&key.frame, 4);
+			file.write((char*)&key.hash, 8);
+			file.write((char*)&key.state, sizeof(State));
+		}
+		return (bool)file;
+	}
+	size_t count() {
+		return keys.size();
+	}
+
+	// Recording
+	// Plays the movie serially from the console's current state, keeping a
+	// keyframe at the start, every interval frames, and at the last frame.
+	// romPath is the file the console's ROM was loaded from.
+	void record(Console* console, Movie& movie, uint32_t every, const char* path) {
+		interval = every;
+		romPath = path;
+		rom = console->mem->romImage();
+		keys.clear();
+		addKey(console, 0);
+		for (uint32_t frame = 0; frame < movie.frameCount(); frame++) {
+			movie.runFrame(console, frame);
+			if ((frame + 1) % interval == 0 || frame + 1 == movie.frameCount()) addKey(console, frame + 1);
+		}
+	}
+	void addKey(Console* console, uint32_t frame) {
+		keys.emplace_back();
+		Keyframe& key = keys.back();
+		key.frame = frame;
+		console->saveState(key.state);
+		key.hash = console->hash();
+	}
+
+	// Verification
+	// Replays each segment between neighbouring keyframes on its own thread,
+	// starting from the earlier keyframe's state and checking that it ends
+	// on the later keyframe's hash.
+	std::vector<Segment> verify(Movie& movie, unsigned int threads = 0) {
+		std::vector<Segment> segments;
+		for (uint32_t i = 0; i + 1 < keys.size(); i++) segments.push_back({ i, i + 1, false });
+
+		if (threads == 0) threads = std::thread::hardware_concurrency();
+		if (threads == 0) threads = 1;
+
+		std::atomic<size_t> next(0);
+		auto worker = [&]() {
+			Console console;
+			console.powerOn(rom);
+			for (size_t i = next++; i < segments.size(); i = next++) {
+				Segment& segment = segments[i];
+				Keyframe& start = keys[segment.first];
+				Keyframe& end = keys[segment.last];
+
+				console.loadState(start.state);
+				if (console.hash() != start.hash) continue; // corrupt keyframe
+				for (uint32_t frame = start.frame; frame < end.frame && frame < movie.frameCount(); frame++) movie.runFrame(&console, frame);
+				segment.ok = console.hash() == end.hash;
+			}
+		};
+
+		std::vector<std::thread> pool;
+		for (unsigned int i = 0; i < threads; i++) pool.emplace_back(worker);
+		for (std::thread& thread : pool) thread.join();
+		return segments;
+	}
+	uint32_t keyFrame(uint32_t key) {
+		return keys[key].frame;
+	}
+
+	void test() {
+		std::cout << "\nTesting Keyframes:";
+
+		// INC $10; LDX $10; STX $8000 (a mapper style write into ROM); JMP $8000
+		static const uint8_t program[] = { 0xE6, 0x10, 0xA6, 0x10, 0x8E, 0x00, 0x80, 0x4C, 0x00, 0x80 };
+		std::shared_ptr<RomImage> image = std::make_shared<RomImage>();
+		image->mapper = 0;
+		image->vertical = false;
+		image->prg.assign(0x4000, 0xEA);
+		std::copy(program, program + sizeof(program), image->prg.begin());
+		image->prg[0x3FFD] = 0x80;	// reset vector $8000
+		image->prg[0x3FFC] = 0x00;
+		image->hash = hashFinal(hashBytes(image->prg.data(), image->prg.size()));
+
+		// segments only replay in sync if the ROM ignores the writes again
+		int err_cnt = 0;
+		Console console;
+		Movie movie;
+		for (int frame = 0; frame < 60; frame++) movie.addFrame(0);
+		console.powerOn(image);
+		record(&console, movie, 10, "");
+		for (Segment& segment : verify(movie, 2)) {
+			if (!segment.ok) err_cnt++;
+		}
+		if (keys.size() != 7) err_cnt++;
+		keys.clear();
+		rom.reset();
+
+		if (err_cnt == 0) std::cout << "\nKeyframes OK\n";
+		else printf("\nKeyframes NOT OK: %d errors found\n", err_cnt);
+	}
+};
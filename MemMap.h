@@ -1,16 +1,599 @@
 #pragma once
 
+#include <algorithm>
+#include <atomic>
+#include <fstream>
+#include <memory>
+#include <vector>
+#include "Arena.h"
+#include "CodeDataLog.h"
+#include "Controller.h"
+#include "Hash.h"
+#include "PPU.h"
+#include "RomCache.h"
+#include "State.h"
+
+// Keep rarely taken paths out of line so the inlined fast path stays small
+#ifdef _MSC_VER
+#define NOINLINE __declspec(noinline)
+#else
+#define NOINLINE __attribute__((noinline))
+#endif
+
+// Watchpoint access types
+enum watchType {
+	WatchRead = 1, WatchWrite = 2, WatchExec = 4
+};
+struct WatchHit {
+	int id;			// Watch that triggered
+	uint16_t addr;
+	uint8_t value;	// Value read, written or fetched
+	uint8_t type;
+};
+
+// One CPU bus access on the test bus
+struct BusCycle {
+	uint16_t addr;
+	uint8_t value;
+	bool write;
+};
+
 class MemMap {
 	// Singleton Class
 	static MemMap* instance;
-	MemMap() {}
+	MemMap() {
+		for (auto& page : ramPage) page = newPage();
+		for (auto& page : crtPage) page = blankPage();
+		clearVideo();
+		installIO();
+		map();
+	}
+	MemMap(const MemMap&) = default;
 
 private:
+	// Memory Pages
+	// RAM and cartridge space are held in 256 byte pages that forked memory
+	// maps share until one side writes to them.
+	struct Page {
+		uint8_t data[0x100];
+	};
+	std::shared_ptr<Page> ramPage[0x08];	// 2KB Work RAM
+	std::shared_ptr<Page> crtPage[0xC0];	// Cartridge Address Space ($4000-$FFFF, below $4020 unused)
+	std::shared_ptr<Page> namePage[0x08];	// 2KB Nametables
+	std::shared_ptr<Page> palettePage;		// Palette RAM, first 32 bytes
+	std::shared_ptr<Page> spritePage;		// OAM
+	std::shared_ptr<Page> chrPage[0x20];	// 8KB CHR RAM, empty on CHR ROM carts
+
+	// Cartridge
+	// PRG pages point into the shared ROM image and ignore writes; unused
+	// cartridge space shares one zero page until written.
+	std::shared_ptr<const RomImage> rom;
+	bool readOnly[0x100] = {};
+	CodeDataLog* cdl = nullptr;	// Not owned; while set, ROM reads take the slow path
+
 	// Memory Regions
-	uint8_t ram[0x0800]; // 2KB Work RAM
-	uint8_t ppu[0x0008]; // PPU Registers
-	uint8_t apu[0x0020]; // APU and IO registers
-	uint8_t crt[0xBFE0]; // Cartridge Address Space
+	PPU ppu;				// PPU Registers and video memory (see Video Pages)
+	uint8_t apu[0x0020];	// APU and IO registers
+
+	// Input Devices
+	Controller pad[2];
+
+	// DMA Units
+	uint16_t dmcAddress = 0;		// Next sample byte
+	uint16_t dmcRemaining = 0;		// Sample bytes left to fetch
+	unsigned int dmcNext = 0;		// Cycle of the next sample fetch
+	uint8_t dmcBuffer = 0;			// Last sample byte fetched
+	bool dmcIRQ = false;
+	unsigned int idleClock = 0;
+	unsigned int* clock = &idleClock;	// CPU cycle counter, charged for DMA stalls
+	bool exactClock = false;			// Counter is already at the current bus cycle (accurate core)
+
+	// APU Frame Counter
+	unsigned int frameCounter = 0;	// Cycle the current 4 step sequence started
+	bool frameIRQ = false;
+
+	// Event Scheduler
+	// Interrupt sources are not clocked every cycle. Each predicts the CPU
+	// cycle its flag next goes up and schedules that as its one event; the
+	// CPU runs straight to the earliest event (or the frame end) and then
+	// runEvents() brings the due sources up to date. A source is predicted
+	// again only when what moves its event changes: its registers, or
+	// acknowledging its flag. The CPU's run limit is pulled in whenever an
+	// event lands before it.
+	enum eventSource {
+		FrameEvent, DMCEvent, EventSources
+	};
+	unsigned int eventAt[EventSources] = {};
+	uint8_t eventArmed = 0;		// One bit per source with an event
+	unsigned int idleLimit = 0;
+	unsigned int* limit = &idleLimit;	// CPU run limit
+
+	// Interrupt Lines
+	// IRQ is one shared level line, held low while any source's flag is up.
+	// NMI is edge triggered: the PPU's output going high latches a request
+	// until the CPU takes it. The CPU looks at both only where it stops
+	// between instructions, so a rising NMI edge pulls the run limit in to
+	// now; IRQ sources already stop it through their events.
+	bool nmiPending = false;
+
+	// Page Tables
+	// Direct pointers for the fast path. A null entry sends the access to
+	// readSlow/writeSlow/fetchSlow: registers, pages that are still shared,
+	// and pages with a watchpoint on them.
+	uint8_t* readPage[0x100];
+	uint8_t* writePage[0x100];
+	uint8_t* execPage[0x100];	// Opcode fetches
+
+	// Watchpoints
+	struct Watch {
+		int id;
+		uint16_t first, last;
+		uint8_t type;
+	};
+	std::vector<Watch> watches;
+	std::vector<WatchHit> hits;
+	uint8_t pageWatch[0x100] = {};	// Watch types present on each page
+	int nextWatch = 1;
+
+	// Patches
+	// Game Genie style overrides of what the CPU reads. A ROM page holding a
+	// patch is mapped to a patched copy of itself; any other page holding
+	// one reads through readSlow. Pages without a patch keep the fast path,
+	// and the state (and its hash) always holds the unpatched bytes.
+	struct Patch {
+		int id;
+		uint16_t addr;		// RAM patches are kept at their $0000-$07FF address
+		int16_t compare;	// Byte that must be there to be replaced, -1 for any
+		uint8_t value;
+	};
+	std::vector<Patch> patches;
+	std::shared_ptr<Page> patchPage[0x100];	// Patched copies of ROM pages
+	bool pagePatch[0x100] = {};				// Patches present on each page
+	int nextPatch = 1;
+
+	// State Hash Cache
+	// Hash of every RAM and cartridge page and PPU memory region as of the
+	// last stateHash(). A page hashed clean is mapped without a write
+	// pointer, so its first write afterwards goes through writeSlow and
+	// ownPage, which marks it dirty; clean slots are not hashed again.
+	enum hashSlot {
+		NameSlot = 0x08 + 0xC0, PatternSlot, SpriteSlot, HashSlots
+	};
+	uint64_t slotHash[HashSlots] = {};
+	bool slotClean[HashSlots] = {};
+	uint64_t memoryHash = 0;	// XOR of slotHash
+
+	// Test Bus
+	// Flat 64KB of RAM with no mirrors, registers or ROM, recording every
+	// access in order, for CPU conformance vectors. Empty on a normal map.
+	std::vector<uint8_t> flat;
+	std::vector<BusCycle> busLog;
+
+	static Arena& pagePool() {
+		static Arena* pages = new Arena(sizeof(Page), 1024);
+		return *pages;
+	}
+	static std::shared_ptr<Page> newPage(const Page& source = Page()) {
+		// pages and their reference counts come from pools, not the heap
+		Page* page = new (pagePool().allocate()) Page(source);
+		return std::shared_ptr<Page>(page, [](Page* old) { pagePool().release(old); }, ArenaAllocator<Page>());
+	}
+	static std::shared_ptr<Page> blankPage() {
+		static const std::shared_ptr<Page> blank = std::make_shared<Page>();
+		return blank;
+	}
+	static bool shared(const std::shared_ptr<Page>& page) {
+		// use_count() is a relaxed load. A fork on another thread may have
+		// just dropped its reference, so once the page looks private the
+		// fence orders its last reads of the page before our writes.
+		if (page.use_count() > 1) return true;
+#ifdef __SANITIZE_THREAD__
+		std::shared_ptr<Page> hold(page);	// TSan ignores fences; taking a reference acquires on the count instead
+#else
+		std::atomic_thread_fence(std::memory_order_acquire);
+#endif
+		return false;
+	}
+	std::shared_ptr<Page>& pageAt(int index) {
+		if (index < 0x20) return ramPage[index % 0x08];
+		return crtPage[index - 0x40];
+	}
+	static int slotOf(int index) {
+		if (index < 0x20) return index % 0x08;
+		return 0x08 + index - 0x40;
+	}
+	void mapPage(int index) {
+		readPage[index] = nullptr;
+		writePage[index] = nullptr;
+		execPage[index] = nullptr;
+		if (!flat.empty()) return;	// test bus logs every access
+		if (index >= 0x20 && index <= 0x40) return; // PPU, APU & IO
+
+		std::shared_ptr<Page>& page = pageAt(index);
+		bool logged = cdl && readOnly[index];
+		bool shadow = readOnly[index] && patchPage[index];
+		bool patched = pagePatch[index] && !shadow;
+		uint8_t* data = shadow ? patchPage[index]->data : page->data;
+		if (!(pageWatch[index] & WatchRead) && !logged && !patched) readPage[index] = data;
+		if (!(pageWatch[index] & WatchExec) && !logged && !patched) execPage[index] = data;
+		if (!(pageWatch[index] & WatchWrite) && !readOnly[index] && !shared(page) && !slotClean[slotOf(index)]) writePage[index] = page->data;
+	}
+	void map() {
+		for (int index = 0; index < 0x100; index++) mapPage(index);
+	}
+	uint8_t* ownPage(int index) {
+		// copy a shared page before its first write, then map it writable
+		std::shared_ptr<Page>& page = pageAt(index);
+		if (shared(page)) page = newPage(*page);
+		readOnly[index] = false;
+		slotClean[slotOf(index)] = false;
+		if (index < 0x20) {
+			for (int mirror = index % 0x08; mirror < 0x20; mirror += 0x08) mapPage(mirror);
+		}
+		else mapPage(index);
+		return page->data;
+	}
+
+	// Video Pages
+	// PPU memory lives in pages shared the same way, which the PPU reads and
+	// writes through plain pointers. Every write to it comes through a
+	// register handler here, which makes the page private first.
+	void clearVideo() {
+		for (auto& page : namePage) page = blankPage();
+		palettePage = spritePage = blankPage();
+		mapCHR();
+	}
+	void mapCHR() {
+		// CHR RAM pages start as the shared blank page
+		const uint8_t* chr = patternROM();
+		for (auto& page : chrPage) page = chr ? nullptr : blankPage();
+		mapVideo();
+	}
+	void mapVideo() {
+		uint8_t* names[0x08];
+		for (int i = 0; i < 0x08; i++) names[i] = namePage[i]->data;
+		ppu.attachMemory(names, palettePage->data, spritePage->data);
+		uint8_t* chr[0x20];
+		for (int i = 0; i < 0x20; i++) chr[i] = chrPage[i] ? chrPage[i]->data : nullptr;
+		ppu.attachCHR(patternROM(), chrPage[0] ? chr : nullptr);
+	}
+	uint8_t* ownVideo(std::shared_ptr<Page>& page) {
+		if (shared(page)) {
+			page = newPage(*page);
+			mapVideo();
+		}
+		return page->data;
+	}
+	static void savePages(const std::shared_ptr<Page>* pages, uint8_t* out, size_t size) {
+		// empty pages (CHR ROM) save as zeros
+		for (size_t offset = 0; offset < size; offset += 0x100) {
+			size_t chunk = std::min<size_t>(size - offset, 0x100);
+			const std::shared_ptr<Page>& page = pages[offset >> 8];
+			if (page) memcpy(out + offset, page->data, chunk);
+			else memset(out + offset, 0, chunk);
+		}
+	}
+	void loadPages(std::shared_ptr<Page>* pages, const uint8_t* in, size_t size) {
+		// unchanged pages stay shared; empty pages (CHR ROM) are skipped
+		for (size_t offset = 0; offset < size; offset += 0x100) {
+			size_t chunk = std::min<size_t>(size - offset, 0x100);
+			std::shared_ptr<Page>& page = pages[offset >> 8];
+			if (page && memcmp(page->data, in + offset, chunk)) memcpy(ownVideo(page), in + offset, chunk);
+		}
+	}
+
+	// I/O Registers
+	// One handler per register for $2000-$401F (PPU registers repeat every
+	// 8 bytes), so only these addresses pay for a call and side effects
+	// stay out of the paged fast path.
+	typedef uint8_t (MemMap::*ReadIO)(uint16_t addr);
+	typedef void (MemMap::*WriteIO)(uint16_t addr, uint8_t value);
+	ReadIO readIO[0x28];
+	WriteIO writeIO[0x28];
+
+	static int ioIndex(uint16_t addr) {
+		if (addr < 0x4000) return addr & 0x07;
+		return 0x08 + (addr & 0x1F);
+	}
+	void installIO() {
+		static const ReadIO ppuRead[8] = {
+			&MemMap::readPPUBus, &MemMap::readPPUBus, &MemMap::readPPUStatus, &MemMap::readPPUBus,
+			&MemMap::readOAMData, &MemMap::readPPUBus, &MemMap::readPPUBus, &MemMap::readPPUData
+		};
+		static const WriteIO ppuWrite[8] = {
+			&MemMap::writePPUCtrl, &MemMap::writePPUMask, &MemMap::writePPUBus, &MemMap::writeOAMAddr,
+			&MemMap::writeOAMData, &MemMap::writePPUScroll, &MemMap::writePPUAddr, &MemMap::writePPUData
+		};
+		for (int reg = 0; reg < 8; reg++) {
+			readIO[reg] = ppuRead[reg];
+			writeIO[reg] = ppuWrite[reg];
+		}
+		for (int reg = 0x08; reg < 0x28; reg++) {
+			readIO[reg] = &MemMap::readOpenBus;
+			writeIO[reg] = &MemMap::writeAPU;
+		}
+		for (int reg = 0x18; reg <= 0x1B; reg++) writeIO[reg] = &MemMap::writeDMC;	// $4010-$4013
+		writeIO[0x1C] = &MemMap::writeOAMDMA;										// $4014
+		readIO[0x1D] = &MemMap::readAPUStatus;										// $4015
+		writeIO[0x1D] = &MemMap::writeAPUStatus;
+		readIO[0x1E] = readIO[0x1F] = &MemMap::readPad;								// $4016/$4017
+		writeIO[0x1E] = &MemMap::writePadStrobe;
+		writeIO[0x1F] = &MemMap::writeFrameCounter;
+	}
+
+	// PPU Registers ($2000-$3FFF)
+	uint8_t readPPUBus(uint16_t) {
+		return ppu.openBus();
+	}
+	uint8_t readPPUStatus(uint16_t) {
+		return ppu.readStatus(*clock);
+	}
+	uint8_t readOAMData(uint16_t) {
+		return ppu.readOAMData();
+	}
+	uint8_t readPPUData(uint16_t) {
+		return ppu.readData();
+	}
+	void writePPUCtrl(uint16_t, uint8_t value) {
+		// enabling NMI during VBlank is an edge too
+		bool before = ppu.nmiOutput(*clock);
+		ppu.writeCtrl(value);
+		if (!before && ppu.nmiOutput(*clock)) raiseNMI();
+	}
+	void writePPUMask(uint16_t, uint8_t value) {
+		ppu.writeMask(value);
+	}
+	void writePPUBus(uint16_t, uint8_t value) {
+		ppu.writeBus(value);
+	}
+	void writeOAMAddr(uint16_t, uint8_t value) {
+		ppu.writeOAMAddr(value);
+	}
+	void writeOAMData(uint16_t, uint8_t value) {
+		slotClean[SpriteSlot] = false;
+		ownVideo(spritePage);
+		ppu.writeOAMData(value);
+	}
+	void writePPUScroll(uint16_t, uint8_t value) {
+		ppu.writeScroll(value);
+	}
+	void writePPUAddr(uint16_t, uint8_t value) {
+		ppu.writeAddr(value);
+	}
+	void writePPUData(uint16_t, uint8_t value) {
+		uint16_t addr = ppu.vramAddress();
+		if (addr >= 0x2000) {
+			slotClean[NameSlot] = false;
+			if (addr >= 0x3F00) ownVideo(palettePage);
+			else ownVideo(namePage[ppu.nametable(addr) >> 8]);
+		}
+		else if (chrPage[0]) {
+			slotClean[PatternSlot] = false;
+			ownVideo(chrPage[addr >> 8]);
+		}
+		ppu.writeData(value);
+	}
+
+	// APU & IO Registers ($4000-$401F)
+	uint8_t readOpenBus(uint16_t addr) {
+		// write only: the data bus still holds the high byte of the operand
+		return addr >> 8;
+	}
+	uint8_t readAPUStatus(uint16_t) {
+		// reading acknowledges the frame interrupt
+		runEvents();
+		syncDMC();
+		uint8_t value = (apu[0x15] & 0x2F) | (frameIRQ ? 0x40 : 0) | (dmcRemaining ? 0x10 : 0) | (dmcIRQ ? 0x80 : 0);
+		if (frameIRQ) {
+			frameIRQ = false;
+			predictFrameIRQ();
+		}
+		return value;
+	}
+	uint8_t readPad(uint16_t addr) {
+		return 0x40 | pad[addr - 0x4016].read();
+	}
+	void writeAPU(uint16_t addr, uint8_t value) {
+		apu[addr - 0x4000] = value;
+	}
+	void writeDMC(uint16_t addr, uint8_t value) {
+		syncDMC();	// settle fetches under the old settings
+		apu[addr - 0x4000] = value;
+		if (addr == 0x4010 && !(value & 0x80)) dmcIRQ = false;
+		predictDMC();
+	}
+	void writeAPUStatus(uint16_t, uint8_t value) {
+		syncDMC();
+		apu[0x15] = value;
+		dmcIRQ = false;
+		if (!(value & 0x10)) dmcRemaining = 0;
+		else if (!dmcRemaining) {
+			startDMC();
+			dmcNext = *clock;
+		}
+		predictDMC();
+	}
+	void writeFrameCounter(uint16_t, uint8_t value) {
+		// restarts the sequence; bit 6 inhibits and clears the interrupt
+		apu[0x17] = value;
+		frameCounter = *clock;
+		if (value & 0x40) frameIRQ = false;
+		predictFrameIRQ();
+	}
+	void writePadStrobe(uint16_t, uint8_t value) {
+		apu[0x16] = value;
+		pad[0].write(value);
+		pad[1].write(value);
+	}
+
+	// DMA
+	// Transfers are done in bulk and the CPU is charged the cycles it would
+	// have been halted for, instead of stepping the bus a byte at a time.
+	void writeOAMDMA(uint16_t, uint8_t page) {
+		// 256 bytes from $xx00 into OAM
+		apu[0x14] = page;
+		slotClean[SpriteSlot] = false;
+		ownVideo(spritePage);
+		uint8_t* source = readPage[page];
+		if (source) ppu.dma(source);
+		else {
+			uint8_t buffer[0x100];
+			for (int i = 0; i < 0x100; i++) buffer[i] = read((page << 8) | i);
+			ppu.dma(buffer);
+		}
+
+		// 1 wait cycle, +1 to align on odd cycles, then 256 read/write pairs.
+		// A fast core clock is still at the instruction start; the store is
+		// then taken as the last cycle of STA abs, 3 cycles later.
+		unsigned int store = *clock + (exactClock ? 0 : 3);
+		*clock += 513 + (store & 1);
+	}
+	void startDMC() {
+		dmcAddress = 0xC000 + apu[0x12] * 0x40;
+		dmcRemaining = apu[0x13] * 0x10 + 1;
+	}
+	unsigned int dmcPeriod() {
+		// CPU cycles between sample fetches
+		static const uint16_t rate[16] = { 428, 380, 340, 320, 286, 254, 226, 214, 190, 160, 142, 128, 106, 84, 72, 54 };
+		return rate[apu[0x10] & 0x0F] * 8;
+	}
+
+	void raiseNMI() {
+		nmiPending = true;
+		*limit = *clock;
+	}
+
+	// Event Prediction
+	void schedule(int source, unsigned int cycle) {
+		eventAt[source] = cycle;
+		eventArmed |= 1 << source;
+		if ((int)(cycle - *limit) < 0) *limit = cycle;
+	}
+	void cancel(int source) {
+		// the CPU may still stop at the old time and find nothing due
+		eventArmed &= ~(1 << source);
+	}
+	bool due(int source) {
+		return (eventArmed >> source & 1) && (int)(*clock - eventAt[source]) >= 0;
+	}
+	void syncFrameCounter() {
+		// move the sequence start up to the one now running
+		frameCounter += (*clock - frameCounter) / 29830 * 29830;
+	}
+	void predictFrameIRQ() {
+		// 4 step mode raises the flag 29829 cycles into every 29830 cycle sequence
+		if (frameIRQ || (apu[0x17] & 0xC0)) return cancel(FrameEvent);
+		syncFrameCounter();
+		unsigned int at = frameCounter + 29829;
+		if ((int)(at - *clock) <= 0) at += 29830;
+		schedule(FrameEvent, at);
+	}
+	void predictDMC() {
+		// the flag goes up as the last byte of a sample is fetched
+		if (dmcIRQ || !dmcRemaining || (apu[0x10] & 0xC0) != 0x80) return cancel(DMCEvent);
+		schedule(DMCEvent, dmcNext + (dmcRemaining - 1) * dmcPeriod());
+	}
+	void predictEvents() {
+		predictFrameIRQ();
+		predictDMC();
+	}
+	NOINLINE uint8_t readSlow(uint16_t addr, int use = CodeDataLog::Data) {
+		if (!flat.empty()) {
+			busLog.push_back({ addr, flat[addr], false });
+			return flat[addr];
+		}
+		uint8_t value;
+		if (addr >= 0x2000 && addr < 0x4020) value = (this->*readIO[ioIndex(addr)])(addr);
+		else value = pageAt(addr >> 8)->data[addr & 0xFF];				// Watched RAM, Cartridge ($4020-$40FF), logged ROM
+		if (pagePatch[addr >> 8]) value = patched(addr, value);
+		if (pageWatch[addr >> 8] & WatchRead) checkWatch(addr, value, WatchRead);
+		if (cdl && readOnly[addr >> 8]) cdl->mark(romOffset(addr), use);
+		return value;
+	}
+	NOINLINE void writeSlow(uint16_t addr, uint8_t value) {
+		if (!flat.empty()) {
+			busLog.push_back({ addr, value, true });
+			flat[addr] = value;
+			return;
+		}
+		if (pageWatch[addr >> 8] & WatchWrite) checkWatch(addr, value, WatchWrite);
+		if (addr >= 0x2000 && addr < 0x4020) (this->*writeIO[ioIndex(addr)])(addr, value);
+		else if (!readOnly[addr >> 8]) ownPage(addr >> 8)[addr & 0xFF] = value;	// Shared, watched, or $4020-$40FF
+	}
+	NOINLINE uint8_t fetchSlow(uint16_t addr) {
+		uint8_t* page = readPage[addr >> 8];
+		uint8_t value = page ? page[addr & 0xFF] : readSlow(addr, CodeDataLog::Code);
+		if (pageWatch[addr >> 8] & WatchExec) checkWatch(addr, value, WatchExec);
+		return value;
+	}
+	uint8_t patched(uint16_t addr, uint8_t value) {
+		if (addr < 0x2000) addr &= 0x07FF;
+		for (const Patch& patch : patches) {
+			if (patch.addr == addr && (patch.compare < 0 || patch.compare == value)) return patch.value;
+		}
+		return value;
+	}
+	void rebuildPatches() {
+		memset(pagePatch, 0, sizeof(pagePatch));
+		for (const Patch& patch : patches) {
+			int index = patch.addr >> 8;
+			if (index < 0x20) {
+				for (int mirror = index; mirror < 0x20; mirror += 0x08) pagePatch[mirror] = true;
+			}
+			else pagePatch[index] = true;
+		}
+		for (int index = 0; index < 0x100; index++) {
+			patchPage[index].reset();
+			if (!pagePatch[index] || !readOnly[index]) continue;
+			patchPage[index] = newPage(*pageAt(index));
+			for (int i = 0; i < 0x100; i++) patchPage[index]->data[i] = patched((uint16_t)(index << 8 | i), patchPage[index]->data[i]);
+		}
+		map();
+	}
+	static bool watchCovers(const Watch& watch, uint16_t addr) {
+		if (addr >= 0x2000) return addr >= watch.first && addr <= watch.last;
+		// RAM mirrors alias the same byte
+		for (uint16_t mirror = addr & 0x07FF; mirror < 0x2000; mirror += 0x0800) {
+			if (mirror >= watch.first && mirror <= watch.last) return true;
+		}
+		return false;
+	}
+	void checkWatch(uint16_t addr, uint8_t value, uint8_t type) {
+		for (const Watch& watch : watches) {
+			if ((watch.type & type) && watchCovers(watch, addr)) hits.push_back({ watch.id, addr, value, type });
+		}
+	}
+	void rebuildWatches() {
+		memset(pageWatch, 0, sizeof(pageWatch));
+		for (const Watch& watch : watches) {
+			for (int index = watch.first >> 8; index <= watch.last >> 8; index++) {
+				if (index < 0x20) {
+					for (int mirror = index % 0x08; mirror < 0x20; mirror += 0x08) pageWatch[mirror] |= watch.type;
+				}
+				else pageWatch[index] |= watch.type;
+			}
+		}
+		map();
+	}
+	void copyOut(uint8_t* out, uint16_t addr, size_t len) {
+		while (len) {
+			size_t chunk = std::min(len, (size_t)(0x100 - (addr & 0xFF)));
+			memcpy(out, pageAt(addr >> 8)->data + (addr & 0xFF), chunk);
+			out += chunk;
+			addr += (uint16_t)chunk;
+			len -= chunk;
+		}
+	}
+	void copyIn(const uint8_t* in, uint16_t addr, size_t len) {
+		while (len) {
+			size_t chunk = std::min(len, (size_t)(0x100 - (addr & 0xFF)));
+			// unchanged pages stay shared (ROM, forks, blank space)
+			if (memcmp(pageAt(addr >> 8)->data + (addr & 0xFF), in, chunk)) memcpy(ownPage(addr >> 8) + (addr & 0xFF), in, chunk);
+			in += chunk;
+			addr += (uint16_t)chunk;
+			len -= chunk;
+		}
+	}
 
 public:
 	// Singleton Class
@@ -18,6 +601,35 @@ public:
 		if (!instance) instance = new MemMap;
 		return instance;
 	}
+	static MemMap* create() {
+		// independent memory map for parallel jobs
+		return new MemMap;
+	}
+	static MemMap* create(void* where) {
+		// built in place, in a block from the instance arena
+		return new (where) MemMap;
+	}
+	static void reservePages(size_t count, bool hugePages) {
+		pagePool().useHugePages(hugePages);
+		pagePool().reserve(count);
+	}
+	static MemMap* createFlat() {
+		// test bus, see Test Bus
+		MemMap* bus = new MemMap;
+		bus->flat.assign(0x10000, 0);
+		bus->map();
+		return bus;
+	}
+	MemMap* fork(void* where = nullptr) {
+		// child shares every page; both sides copy a page on first write
+		MemMap* child = where ? new (where) MemMap(*this) : new MemMap(*this);
+		child->clock = &child->idleClock;
+		child->limit = &child->idleLimit;
+		child->cdl = nullptr;
+		child->map();
+		map();
+		return child;
+	}
 
 	// Emulator Utilities
 	void test() {
@@ -26,6 +638,7 @@ public:
 		int err_cnt = 0;
 		int value;
 		for (int i = 0; i <= 0xFFFF; i++) {
+			if (i >= 0x2000 && i < 0x4020) continue; // registers are tested below
 			write(i, i);
 
 			value = read(i);
@@ -35,31 +648,552 @@ public:
 			}
 		}
 
+		std::cout << "\n  Fork: ";{
+			MemMap* child = fork();
+			child->write(0x0123, 0xAB);
+			child->write(0x6000, 0xCD);
+			if (read(0x0123) == 0x23 && read(0x6000) == 0x00 && child->read(0x0923) == 0xAB && child->read(0x6000) == 0xCD && child->sharedPages() == 0xC8 - 2) std::cout << "OK";
+			else {
+				std::cout << "Error: forked pages not copied on write";
+				err_cnt++;
+			}
+			delete child;
+		}
+		std::cout << "\n  Video pages: ";{
+			// CHR RAM (no ROM here), nametables and OAM are shared the same way
+			MemMap* child = fork();
+			child->read(0x2002);
+			child->write(0x2006, 0x01);
+			child->write(0x2006, 0x23);
+			child->write(0x2007, 0x5A);
+			child->write(0x2006, 0x2C);
+			child->write(0x2006, 0x45);
+			child->write(0x2007, 0xA5);	// mirror of $2845 in horizontal mirroring
+			child->write(0x2003, 0x10);
+			child->write(0x2004, 0x3C);
+			bool copied = ppu.readVRAM(0x0123) == 0x00 && child->ppu.readVRAM(0x0123) == 0x5A && child->chrPage[0x01] != chrPage[0x01] &&
+				ppu.readVRAM(0x2845) == 0x00 && child->ppu.readVRAM(0x2845) == 0xA5 && child->namePage[0x04] != namePage[0x04] &&
+				ppu.oam[0x10] == 0x00 && child->ppu.oam[0x10] == 0x3C && child->spritePage != spritePage;
+			bool shared = child->chrPage[0x00] == chrPage[0x00] && chrPage[0x01] == blankPage() &&
+				child->namePage[0x00] == namePage[0x00] && namePage[0x04] == blankPage() && child->palettePage == palettePage;
+			if (copied && shared) std::cout << "OK";
+			else {
+				std::cout << "Error: video pages not copied on write";
+				err_cnt++;
+			}
+			delete child;
+		}
+
+		std::cout << "\n  Watch: ";{
+			int id = addWatch(0x0300, 0x0301, WatchWrite);
+			addWatch(0x8000, 0x8000, WatchExec);
+			write(0x0300, 0x11);		// hit
+			write(0x0B01, 0x22);		// hit through a mirror
+			write(0x0302, 0x33);		// same page, outside the range
+			read(0x0300);				// wrong type
+			fetch(0x8000);				// hit
+			bool fastPath = readPage[0x03] && !writePage[0x03] && writePage[0x04] && !execPage[0x80] && execPage[0x81];
+			removeWatch(id);
+			bool unmapped = writePage[0x03] != nullptr;
+			if (hits.size() == 3 && hits[1].addr == 0x0B01 && hits[1].value == 0x22 && hits[2].type == WatchExec && read(0x0302) == 0x33 && fastPath && unmapped) std::cout << "OK";
+			else {
+				std::cout << "Error: watchpoints missed or mapped the wrong pages";
+				err_cnt++;
+			}
+			clearWatches();
+			clearHits();
+		}
+
+		std::cout << "\n  I/O: ";{
+			ppu.beginFrame(*clock);
+			write(0x2000, 0x00);		// increment by 1
+			read(0x2002);				// reset the write toggle
+			write(0x2006, 0x21);
+			write(0x2006, 0x08);
+			write(0x3FFF, 0xAB);		// $2007 through a mirror
+			write(0x2007, 0xCD);
+			write(0x2006, 0x21);
+			write(0x2006, 0x08);
+			read(0x2007);				// fills the read buffer
+			bool buffered = read(0x2007) == 0xAB && read(0x2007) == 0xCD;
+			write(0x2006, 0x3F);
+			write(0x2006, 0x10);
+			write(0x2007, 0x2A);		// mirrors the backdrop at $3F00
+			write(0x2006, 0x3F);
+			write(0x2006, 0x00);
+			bool palette = (read(0x2007) & 0x3F) == 0x2A;
+
+			ppu.beginFrame(*clock);
+			write(0x2005, 0x1F);		// leaves 0x1F on the PPU bus
+			bool vblank = read(0x2002) == 0x9F && read(0x2002) == 0x1F;
+			bool openBus = read(0x2000) == 0x1F && read(0x4000) == 0x40;
+			if (buffered && palette && vblank && openBus) std::cout << "OK";
+			else {
+				std::cout << "Error: register side effects missing";
+				err_cnt++;
+			}
+		}
+
+		std::cout << "\n  DMA: ";{
+			for (int i = 0; i < 0x100; i++) write(0x0200 + i, i);
+			write(0x2003, 0x10);
+			unsigned int before = *clock;
+			write(0x4014, 0x02);
+			unsigned int oamStall = *clock - before;
+
+			write(0x4015, 0x00);	// stop the sample the write test started
+			write(0x4010, 0x8F);	// IRQ at end, fastest rate
+			write(0x4012, 0x00);
+			write(0x4013, 0x01);	// 17 bytes
+			write(0x4015, 0x10);
+			bool playing = (read(0x4015) & 0x90) == 0x10;
+			*clock += 17 * 54 * 8;
+			bool done = (read(0x4015) & 0x90) == 0x80;
+			if (ppu.oam[0x10] == 0x00 && ppu.oam[0x0F] == 0xFF && (oamStall == 513 || oamStall == 514) && playing && done && dmcAddress == 0xC011) std::cout << "OK";
+			else {
+				std::cout << "Error: DMA copied the wrong bytes or stalled for the wrong time";
+				err_cnt++;
+			}
+		}
+
+		std::cout << "\n  Events: ";{
+			// predicted events land on the cycle each flag goes up
+			unsigned int start = *clock;
+			*limit = start + 100000;
+			write(0x4017, 0x00);		// frame counter sequence starts now
+			bool frameNext = nextEvent(start + 100000) == start + 29829 && *limit == start + 29829;
+			*clock = start + 29828;
+			bool early = !(read(0x4015) & 0x40);
+			*clock = start + 29829;
+			bool raised = (read(0x4015) & 0x40) && !(read(0x4015) & 0x40);	// reading acknowledges
+			bool repeats = nextEvent(start + 100000) == start + 29829 + 29830;
+
+			write(0x4015, 0x00);
+			write(0x4010, 0x8F);
+			write(0x4013, 0x01);		// 17 bytes, the last 16 periods after the first
+			write(0x4015, 0x10);
+			bool dmcNext = nextEvent(start + 100000) == start + 29829 + 16 * 54 * 8;
+			write(0x4017, 0x40);		// inhibit
+			write(0x4010, 0x0F);		// no DMC interrupt
+			bool quiet = nextEvent(start + 100000) == start + 100000;
+			write(0x4015, 0x00);
+			if (frameNext && early && raised && repeats && dmcNext && quiet) std::cout << "OK";
+			else {
+				std::cout << "Error: events predicted at the wrong cycle";
+				err_cnt++;
+			}
+		}
+
+		std::cout << "\n  Hash: ";{
+			uint64_t before = stateHash(hashSeed);
+			bool unmapped = !writePage[0x01] && !writePage[0x11];	// clean pages
+			uint8_t old = read(0x0901);
+			write(0x0901, old ^ 0xFF);
+			bool changed = stateHash(hashSeed) != before && !writePage[0x09];
+			write(0x0101, old);
+			bool restored = stateHash(hashSeed) == before;
+			MemMap* child = fork();
+			bool same = child->sameState(*this);
+			child->write(0x2000, 0x80);
+			if (unmapped && changed && restored && same && child->stateHash(hashSeed) != before && !child->sameState(*this)) std::cout << "OK";
+			else {
+				std::cout << "Error: state hash missed a write";
+				err_cnt++;
+			}
+			delete child;
+		}
+
+		std::cout << "\n  ROM: ";{
+			std::shared_ptr<RomImage> image = std::make_shared<RomImage>();
+			image->prg.resize(0x4000);
+			for (int i = 0; i < 0x4000; i++) image->prg[i] = (uint8_t)(i * 3);
+			image->vertical = false;
+			MemMap* other = create();
+			other->mapROM(image);
+			mapROM(image);
+			write(0x8001, 0xFF);		// ROM ignores writes
+			if (read(0x8001) == 0x03 && read(0xC001) == 0x03 && readPage[0x80] == other->readPage[0x80] && !writePage[0x80]) std::cout << "OK";
+			else {
+				std::cout << "Error: ROM pages not shared read only";
+				err_cnt++;
+			}
+			uint8_t* other0 = readPage[0x80];	// unpatched ROM page
+			delete other;
+
+			std::cout << "\n  Log: ";
+			CodeDataLog log;
+			setLog(&log);
+			fetch(0xC000);				// opcode, through the mirror
+			operand(0x8001);
+			read(0x8002);
+			bool routed = !readPage[0x80] && !execPage[0xC0];
+			setLog(nullptr);
+			if (log.marked(0, CodeDataLog::Code) && log.marked(1, CodeDataLog::Operand) && log.marked(2, CodeDataLog::Data) && log.count(CodeDataLog::Data, 0) == 1 && log.untouched(1) == 0x2000 && routed && readPage[0x80]) std::cout << "OK";
+			else {
+				std::cout << "Error: ROM use logged wrongly";
+				err_cnt++;
+			}
+
+			std::cout << "\n  Patch: ";
+			addPatch(0x8001, 0x77);
+			int id = addPatch(0xC002, 0x88, 0x06);		// compare matches
+			addPatch(0x8003, 0x99, 0x00);				// compare does not
+			addPatch(0x0901, 0x55);						// RAM, through a mirror
+			write(0x0101, 0x44);
+			bool shadowed = readPage[0x80] && readPage[0x80] != other0 && !readPage[0x01] && !readPage[0x11] && readPage[0x02] && readPage[0x90];
+			bool patchedReads = read(0x8001) == 0x77 && fetch(0xC002) == 0x88 && read(0x8002) == 0x06 && read(0x8003) == 0x09 && read(0xC001) == 0x03 && read(0x1101) == 0x55;
+			State* saved = new State();
+			saveState(*saved);
+			bool unpatchedState = saved->ram[0x0101] == 0x44 && saved->crt[0x8001 - 0x4020] == 0x03;
+			delete saved;
+			removePatch(id);
+			bool removed = read(0xC002) == 0x06 && read(0x8001) == 0x77;
+			clearPatches();
+			if (shadowed && patchedReads && unpatchedState && removed && readPage[0x80] == other0 && readPage[0x01]) std::cout << "OK";
+			else {
+				std::cout << "Error: patches read wrongly or slowed unpatched pages";
+				err_cnt++;
+			}
+		}
+
 		clear();
 
 		if (err_cnt == 0) std::cout << "\nMemory Map OK\n";
 		else printf("\nMemory Map NOT OK: %d errors found\n", err_cnt);
 	}
 	void clear() {
-		for (uint16_t i = 0; i <= 0xBFE0; i++) {
-			ram[i % 0x0800] = 0;
-			ppu[i % 0x0008] = 0;
-			ram[i % 0x0020] = 0;
-			crt[i] = 0;
+		for (auto& page : ramPage) {
+			if (shared(page)) page = newPage();
+			memset(page->data, 0, sizeof(Page));
+		}
+		for (auto& page : crtPage) page = blankPage();
+		memset(readOnly, 0, sizeof(readOnly));
+		rom.reset();
+		memset(apu, 0, sizeof(apu));
+		ppu.clear();
+		clearVideo();
+		pad[0].clear();
+		pad[1].clear();
+		dmcAddress = dmcRemaining = 0;
+		dmcNext = 0;
+		dmcBuffer = 0;
+		dmcIRQ = false;
+		frameCounter = *clock;
+		frameIRQ = false;
+		nmiPending = false;
+		eventArmed = 0;
+		predictEvents();
+		memset(slotClean, 0, sizeof(slotClean));
+		rebuildPatches();
+	}
+	void reset() {
+		// reset button: the APU is silenced and the frame sequence restarts
+		// on the clock as it stands
+		writeAPUStatus(0x4015, 0);
+		frameIRQ = false;
+		writeFrameCounter(0x4017, apu[0x17]);
+	}
+	bool loadROM(const char* path) {
+		std::shared_ptr<const RomImage> image = RomCache::getInstance()->load(path);
+		if (!image) return false;
+		mapROM(image);
+		return true;
+	}
+	void mapROM(std::shared_ptr<const RomImage> image) {
+		// NROM: PRG at $8000, 16KB images mirrored into $C000
+		rom = image;
+		if (cdl) cdl->resize(rom->prg.size());
+		for (int index = 0x80; index < 0x100; index++) {
+			const uint8_t* data = rom->prg.data() + ((index - 0x80) * 0x100) % rom->prg.size();
+			crtPage[index - 0x40] = std::shared_ptr<Page>(rom, (Page*)data);
+			readOnly[index] = true;
+			slotClean[slotOf(index)] = false;
+		}
+		slotClean[NameSlot] = slotClean[PatternSlot] = false;
+		rebuildPatches();
+		ppu.loadCHR(rom->vertical);
+		mapCHR();
+	}
+	size_t romOffset(uint16_t addr) {
+		// PRG byte mapped at addr; only valid on ROM pages
+		return pageAt(addr >> 8)->data - rom->prg.data() + (addr & 0xFF);
+	}
+	int bank(uint16_t addr) {
+		// 8KB PRG bank mapped at addr, -1 outside ROM
+		if (!rom || !readOnly[addr >> 8]) return -1;
+		return (int)(romOffset(addr) / 0x2000);
+	}
+	void setLog(CodeDataLog* recorder) {
+		// logs ROM use until set back to null
+		cdl = recorder;
+		if (cdl && rom) cdl->resize(rom->prg.size());
+		map();
+	}
+	uint64_t romHash() {
+		return rom ? rom->hash : 0;
+	}
+	std::shared_ptr<const RomImage> romImage() {
+		return rom;
+	}
+	const uint8_t* patternROM() {
+		if (!rom || rom->chr.empty()) return nullptr;
+		return rom->chr.data();
+	}
+	void saveState(State& state) {
+		copyOut(state.ram, 0x0000, sizeof(state.ram));
+		state.ppu = ppu;
+		state.ppu.attachMemory(nullptr, nullptr, nullptr);	// process-local; loadState points it back
+		state.ppu.attachCHR(nullptr, nullptr);
+		savePages(namePage, state.ciram, sizeof(state.ciram));
+		savePages(&palettePage, state.palette, sizeof(state.palette));
+		savePages(&spritePage, state.oam, sizeof(state.oam));
+		savePages(chrPage, state.chrRAM, sizeof(state.chrRAM));
+		memcpy(state.apu, apu, sizeof(apu));
+		copyOut(state.crt, 0x4020, sizeof(state.crt));
+		state.dmcAddress = dmcAddress;
+		state.dmcRemaining = dmcRemaining;
+		state.dmcNext = dmcNext;
+		state.dmcBuffer = dmcBuffer;
+		state.dmcIRQ = dmcIRQ;
+		state.frameCounter = frameCounter;
+		state.frameIRQ = frameIRQ;
+		state.pad[0] = pad[0];
+		state.pad[1] = pad[1];
+	}
+	void loadState(const State& state) {
+		copyIn(state.ram, 0x0000, sizeof(state.ram));
+		ppu = state.ppu;
+		slotClean[NameSlot] = slotClean[PatternSlot] = slotClean[SpriteSlot] = false;
+		loadPages(namePage, state.ciram, sizeof(state.ciram));
+		loadPages(&palettePage, state.palette, sizeof(state.palette));
+		loadPages(&spritePage, state.oam, sizeof(state.oam));
+		loadPages(chrPage, state.chrRAM, sizeof(state.chrRAM));
+		mapVideo();
+		memcpy(apu, state.apu, sizeof(apu));
+		copyIn(state.crt, 0x4020, sizeof(state.crt));
+		dmcAddress = state.dmcAddress;
+		dmcRemaining = state.dmcRemaining;
+		dmcNext = state.dmcNext;
+		dmcBuffer = state.dmcBuffer;
+		dmcIRQ = state.dmcIRQ;
+		frameCounter = state.frameCounter;
+		frameIRQ = state.frameIRQ;
+		nmiPending = false;
+		pad[0] = state.pad[0];
+		pad[1] = state.pad[1];
+		predictEvents();
+	}
+	void readRAM(uint8_t* out) {
+		copyOut(out, 0x0000, 0x0800);
+	}
+	void writeRAM(const uint8_t* in) {
+		copyIn(in, 0x0000, 0x0800);
+	}
+	const uint8_t* ramView(int page) {
+		// one 256 byte page of work RAM, in place; a write to a shared page
+		// moves it, so the pointer only lasts until the CPU runs again
+		return ramPage[page]->data;
+	}
+	uint8_t* flatMemory() {
+		return flat.data();
+	}
+	void idle(uint16_t addr) {
+		// a read the CPU throws away, made only to log it on the test bus
+		if (!flat.empty()) busLog.push_back({ addr, flat[addr], false });
+	}
+	const std::vector<BusCycle>& busCycles() {
+		return busLog;
+	}
+	void clearBusCycles() {
+		busLog.clear();
+	}
+	int sharedPages() {
+		int count = 0;
+		for (auto& page : ramPage) count += page.use_count() > 1;
+		for (auto& page : crtPage) count += page.use_count() > 1;
+		return count;
+	}
+	uint64_t hash(uint64_t h) {
+		// same result as hashing the 2KB of RAM in one piece
+		for (auto& page : ramPage) h = hashWords(page->data, sizeof(Page), h);
+		return hashMix(h, 0x0800);
+	}
+	uint64_t stateHash(uint64_t h) {
+		// everything in State, rehashing only what changed (see State Hash Cache)
+		for (int slot = 0; slot < HashSlots; slot++) {
+			if (slotClean[slot]) continue;
+			uint64_t seed = hashMix(hashSeed, slot);
+			memoryHash ^= slotHash[slot];
+			if (slot == NameSlot) slotHash[slot] = ppu.hashNames(seed);
+			else if (slot == PatternSlot) slotHash[slot] = ppu.hashPatterns(seed);
+			else if (slot == SpriteSlot) slotHash[slot] = ppu.hashSprites(seed);
+			else {
+				const Page& page = *(slot < 0x08 ? ramPage[slot] : crtPage[slot - 0x08]);
+				slotHash[slot] = hashWords(page.data, sizeof(Page), seed);
+			}
+			slotHash[slot] = hashFinal(slotHash[slot]);
+			memoryHash ^= slotHash[slot];
+			slotClean[slot] = true;
+
+			// drop the write pointer so the next write marks the page dirty
+			if (slot < 0x08) {
+				for (int mirror = slot; mirror < 0x20; mirror += 0x08) writePage[mirror] = nullptr;
+			}
+			else if (slot < NameSlot) writePage[slot - 0x08 + 0x40] = nullptr;
+		}
+
+		h = hashMix(h, memoryHash);
+		h = ppu.hashRegisters(h);
+		h = hashWords(apu, sizeof(apu), h);
+		h = hashMix(h, pad[0].pack() | (uint64_t)pad[1].pack() << 32);
+		h = hashMix(h, dmcAddress | (uint32_t)dmcRemaining << 16 | (uint64_t)dmcBuffer << 32 | (uint64_t)dmcIRQ << 40 | (uint64_t)frameIRQ << 48);
+		return hashMix(h, dmcNext | (uint64_t)frameCounter << 32);
+	}
+	bool sameState(MemMap& other) {
+		// full comparison; pages still shared between the two are skipped
+		for (int index = 0; index < 0x08; index++) {
+			if (ramPage[index] != other.ramPage[index] && memcmp(ramPage[index]->data, other.ramPage[index]->data, sizeof(Page))) return false;
+		}
+		for (int index = 0; index < 0xC0; index++) {
+			if (crtPage[index] != other.crtPage[index] && memcmp(crtPage[index]->data, other.crtPage[index]->data, sizeof(Page))) return false;
+		}
+		return ppu.sameAs(other.ppu) && !memcmp(apu, other.apu, sizeof(apu)) && pad[0].pack() == other.pad[0].pack() &&
+			pad[1].pack() == other.pad[1].pack() && dmcAddress == other.dmcAddress && dmcRemaining == other.dmcRemaining &&
+			dmcNext == other.dmcNext && dmcBuffer == other.dmcBuffer && dmcIRQ == other.dmcIRQ &&
+			frameCounter == other.frameCounter && frameIRQ == other.frameIRQ;
+	}
+
+	// Watchpoints
+	// Only pages holding a watch leave the fast path; every other access is
+	// unaffected. Hits are collected until clearHits().
+	int addWatch(uint16_t first, uint16_t last, uint8_t type) {
+		watches.push_back({ nextWatch, first, last, type });
+		rebuildWatches();
+		return nextWatch++;
+	}
+	void removeWatch(int id) {
+		watches.erase(std::remove_if(watches.begin(), watches.end(), [id](const Watch& watch) { return watch.id == id; }), watches.end());
+		rebuildWatches();
+	}
+	void clearWatches() {
+		watches.clear();
+		rebuildWatches();
+	}
+	const std::vector<WatchHit>& watchHits() {
+		return hits;
+	}
+	void clearHits() {
+		hits.clear();
+	}
+
+	// Patches
+	int addPatch(uint16_t addr, uint8_t value, int compare = -1) {
+		// reads of addr return value, only where compare is there (if given)
+		patches.push_back({ nextPatch, addr < 0x2000 ? (uint16_t)(addr & 0x07FF) : addr, (int16_t)compare, value });
+		rebuildPatches();
+		return nextPatch++;
+	}
+	void removePatch(int id) {
+		patches.erase(std::remove_if(patches.begin(), patches.end(), [id](const Patch& patch) { return patch.id == id; }), patches.end());
+		rebuildPatches();
+	}
+	void clearPatches() {
+		patches.clear();
+		rebuildPatches();
+	}
+
+	// DMA
+	void setClock(unsigned int* counter, bool exact = false) {
+		clock = counter;
+		exactClock = exact;
+	}
+	void syncDMC() {
+		// fetch every sample byte that has come due, 4 stall cycles each
+		while (dmcRemaining && (int)(*clock - dmcNext) >= 0) {
+			dmcBuffer = read(dmcAddress);
+			dmcAddress = dmcAddress == 0xFFFF ? 0x8000 : dmcAddress + 1;
+			dmcNext += dmcPeriod();
+			*clock += 4;
+			if (--dmcRemaining) continue;
+			if (apu[0x10] & 0x40) startDMC();
+			else if (apu[0x10] & 0x80) dmcIRQ = true;
 		}
 	}
+	void beginFrame() {
+		syncDMC();
+		syncFrameCounter();
+		bool before = ppu.nmiOutput(*clock);
+		ppu.beginFrame(*clock);
+		if (!before && ppu.nmiOutput(*clock)) raiseNMI();
+	}
+
+	// Events
+	void setLimit(unsigned int* runLimit) {
+		limit = runLimit;
+	}
+	void runEvents() {
+		// bring every source whose event has come due up to date
+		if (due(FrameEvent)) {
+			frameIRQ = true;
+			predictFrameIRQ();
+		}
+		if (due(DMCEvent)) {
+			syncDMC();
+			predictDMC();
+		}
+	}
+	enum irqLine {
+		FrameLine = 1, DMCLine = 2
+	};
+	uint8_t irqLines() {
+		// sources holding IRQ
+		return (frameIRQ ? FrameLine : 0) | (dmcIRQ ? DMCLine : 0);
+	}
+	bool takeNMI() {
+		// clears the latched edge
+		bool edge = nmiPending;
+		nmiPending = false;
+		return edge;
+	}
+	unsigned int nextEvent(unsigned int until) {
+		// earliest event, or until if none comes before it
+		for (int source = 0; source < EventSources; source++) {
+			if ((eventArmed >> source & 1) && (int)(eventAt[source] - until) < 0) until = eventAt[source];
+		}
+		return until;
+	}
+
+	// Video Output
+	void render(Frame& frame) {
+		ppu.render(frame);
+	}
+
+	// Input Devices
+	void setInput(int port, uint8_t buttons) {
+		pad[port].setButtons(buttons);
+	}
 
 	// Memory Functions
 	uint8_t read(uint16_t addr) {
-		if (addr < 0x2000) return ram[addr % 0x0800];					// RAM + Mirrors
-		else if (addr < 0x4000) return ppu[(addr - 0x2000) % 0x0008];	// PPU + Mirrors
-		else if (addr < 0x4020) return apu[(addr - 0x4000)];			// APU & IO
-		else return crt[(addr - 0x4020)];								// Cartridge
+		uint8_t* page = readPage[addr >> 8];
+		if (page) return page[addr & 0xFF];	// RAM + Mirrors, Cartridge
+		return readSlow(addr);
 	}
 	void write(uint16_t addr, uint8_t value) {
-		if (addr < 0x2000) ram[addr % 0x0800] = value;					// RAM + Mirrors
-		else if (addr < 0x4000) ppu[(addr - 0x2000) % 0x0008] = value;	// PPU + Mirrors
-		else if (addr < 0x4020) apu[(addr - 0x4000)] = value;			// APU & IO
-		else crt[(addr - 0x4020)] = value;								// Cartridge
+		uint8_t* page = writePage[addr >> 8];
+		if (page) page[addr & 0xFF] = value;	// RAM + Mirrors, Cartridge (not shared)
+		else writeSlow(addr, value);
+	}
+	uint8_t operand(uint16_t addr) {
+		// instruction operand bytes; same fast path as read()
+		uint8_t* page = readPage[addr >> 8];
+		if (page) return page[addr & 0xFF];
+		return readSlow(addr, CodeDataLog::Operand);
+	}
+	uint8_t fetch(uint16_t addr) {
+		// opcode fetch, routed separately so exec watches cost nothing elsewhere
+		uint8_t* page = execPage[addr >> 8];
+		if (page) return page[addr & 0xFF];
+		return fetchSlow(addr);
 	}
 };
@@ -0,0 +1,117 @@
+#pragma once
+
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+#include "Console.h"
+
+// Input Movie (.nesm)
+//   "NESM", version, port count, frame count (32 bit little endian),
+//   then one button byte per port per frame (bit 0 = A ... bit 7 = Right)
+class Movie {
+private:
+	uint8_t ports = 1;
+	std::vector<uint8_t> input;
+
+public:
+	struct Checkpoint {
+		uint32_t frame;	// Frames completed
+		uint64_t hash;	// CPU + RAM state hash
+	};
+
+	// File Access
+	bool load(const char* path) {
+		std::ifstream file(path, std::ios::binary);
+		uint8_t header[10];
+		file.read((char*)header, 10);
+		if (!file || header[0] != 'N' || header[1] != 'E' || header[2] != 'S' || header[3] != 'M' || header[4] != 1) {
+			printf("\nError: %s is not a movie file\n", path);
+			return false;
+		}
+		ports = header[5];
+		uint32_t frames = header[6] | (header[7] << 8) | (header[8] << 16) | ((uint32_t)header[9] << 24);
+		if (ports < 1 || ports > 2) {
+			printf("\nError: %s has %d controller ports\n", path, ports);
+			return false;
+		}
+
+		input.resize((size_t)frames * ports);
+		file.read((char*)input.data(), input.size());
+		if (!file) {
+			printf("\nError: %s is truncated\n", path);
+			return false;
+		}
+		return true;
+	}
+	bool save(const char* path) {
+		std::ofstream file(path, std::ios::binary);
+		uint32_t frames = frameCount();
+		uint8_t header[10] = { 'N', 'E', 'S', 'M', 1, ports,
+			(uint8_t)frames, (uint8_t)(frames >> 8), (uint8_t)(frames >> 16), (uint8_t)(frames >> 24) };
+		file.write((char*)header, 10);
+		file.write((char*)input.data(), input.size());
+		return (bool)file;
+	}
+	static bool loadHashes(const char* path, std::vector<Checkpoint>& hashes) {
+		// one "frame <n> hash <hex>" line per checkpoint, as written by play()
+		std::ifstream file(path);
+		if (!file) {
+			printf("\nError: cannot open hash log %s\n", path);
+			return false;
+		}
+		std::string word;
+		Checkpoint point;
+		while (file >> word >> point.frame >> word >> std::hex >> point.hash >> std::dec) hashes.push_back(point);
+		return true;
+	}
+
+	// Input Stream
+	uint32_t frameCount() {
+		return (uint32_t)(input.size() / ports);
+	}
+	uint8_t portCount() {
+		return ports;
+	}
+	uint8_t getInput(uint32_t frame, int port) {
+		return input[(size_t)frame * ports + port];
+	}
+	void setPorts(uint8_t count) {
+		input.clear();
+		ports = count;
+	}
+	void addFrame(uint8_t p1, uint8_t p2 = 0) {
+		input.push_back(p1);
+		if (ports > 1) input.push_back(p2);
+	}
+
+	// Playback
+	void runFrame(Console* console, uint32_t frame) {
+		console->mem->setInput(0, getInput(frame, 0));
+		if (ports > 1) console->mem->setInput(1, getInput(frame, 1));
+		console->cpu->runFrame();
+	}
+	// Feeds one frame of input at a time with no frame limiter, hashing CPU
+	// and RAM every hashInterval frames. Returns the first frame whose hash
+	// disagrees with the reference log, or -1 if the run stayed in sync.
+	long play(Console* console, uint32_t hashInterval, std::ostream* log = nullptr, const std::vector<Checkpoint>* reference = nullptr) {
+		size_t next = 0;
+		for (uint32_t frame = 0; frame < frameCount(); frame++) {
+			runFrame(console, frame);
+
+			if (hashInterval == 0 || (frame + 1) % hashInterval != 0) continue;
+			uint64_t hash = console->hash();
+			if (log) {
+				char line[48];
+				snprintf(line, sizeof(line), "frame %u hash %016llx\n", frame + 1, (unsigned long long)hash);
+				*log << line;
+			}
+			if (!reference) continue;
+
+			// compare against the reference checkpoint for this frame, if any
+			while (next < reference->size() && (*reference)[next].frame < frame + 1) next++;
+			if (next < reference->size() && (*reference)[next].frame == frame + 1 && (*reference)[next].hash != hash) return frame + 1;
+		}
+		return -1;
+	}
+};
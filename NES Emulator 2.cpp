@@ -1,14 +1,612 @@
 #include <iostream>
+#include <chrono>
+#include <cstring>
+#include <string>
 #include "MemMap.h"
 #include "CPU.h"
+#include "Keyframes.h"
+#include "Replay.h"
+#include "CPUBatch.h"
+#include "Video.h"
+#include "FrameStream.h"
+#include "Template.h"
+#include "Conformance.h"
+#include "TestROMs.h"
+#include "RamSearch.h"
+#include "Cheats.h"
+#include "Netplay.h"
+#include "NesAPI.h"
 
 using namespace std;
 
 MemMap* MemMap::instance = 0;
 CPU* CPU::instance = 0;
+RomCache* RomCache::instance = 0;
 
-int main()
+// Movie playback: --play <rom> <movie> [--interval n] [--verify hashes] [--log hashes] [--accurate] [--cheat code]...
+int playMovie(int argc, char* argv[])
 {
+    if (argc < 4) {
+        cout << "Usage: --play <rom> <movie> [--interval n] [--verify hashes] [--log hashes] [--accurate] [--cheat code]...\n";
+        return 1;
+    }
+    uint32_t interval = 60;
+    const char* verifyPath = nullptr;
+    const char* logPath = nullptr;
+    bool accurate = false;
+    vector<string> cheats;
+    for (int i = 4; i < argc; i++) {
+        if (!strcmp(argv[i], "--accurate")) accurate = true;
+        else if (i + 1 == argc) break;
+        else if (!strcmp(argv[i], "--interval")) interval = stoul(argv[++i]);
+        else if (!strcmp(argv[i], "--verify")) verifyPath = argv[++i];
+        else if (!strcmp(argv[i], "--log")) logPath = argv[++i];
+        else if (!strcmp(argv[i], "--cheat")) cheats.push_back(argv[++i]);
+    }
+
+    Movie movie;
+    vector<Movie::Checkpoint> reference;
+    if (!movie.load(argv[3])) return 1;
+    if (verifyPath && !Movie::loadHashes(verifyPath, reference)) return 1;
+    ofstream logFile;
+    if (logPath) logFile.open(logPath);
+
+    Console console(accurate);
+    if (!console.powerOn(argv[2])) return 1;
+    for (const string& cheat : cheats) {
+        if (!Cheats::apply(console.mem, cheat)) return 1;
+    }
+
+    auto start = chrono::steady_clock::now();
+    long desync = movie.play(&console, interval, logPath ? &logFile : &cout, verifyPath ? &reference : nullptr);
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+    printf("\n%u frames in %.2fs (%.0f fps)\n", movie.frameCount(), seconds, movie.frameCount() / seconds);
+    if (desync >= 0) {
+        printf("Desync at frame %ld\n", desync);
+        return 2;
+    }
+    if (verifyPath) cout << "Movie in sync\n";
+    return 0;
+}
+
+// Keyframe recording: --record-keys <rom> <movie> <keyframes> [--interval n]
+int recordKeyframes(int argc, char* argv[])
+{
+    if (argc < 5) {
+        cout << "Usage: --record-keys <rom> <movie> <keyframes> [--interval n]\n";
+        return 1;
+    }
+    uint32_t interval = 600;
+    if (argc > 6 && !strcmp(argv[5], "--interval")) interval = stoul(argv[6]);
+
+    Movie movie;
+    Console console;
+    if (!movie.load(argv[3]) || !console.powerOn(argv[2])) return 1;
+
+    Keyframes keys;
+    keys.record(&console, movie, interval, argv[2]);
+    if (!keys.save(argv[4])) return 1;
+    printf("\n%zu keyframes written\n", keys.count());
+    return 0;
+}
+
+// Parallel segment verification: --segments <movie> <keyframes> [--threads n]
+int verifySegments(int argc, char* argv[])
+{
+    if (argc < 4) {
+        cout << "Usage: --segments <movie> <keyframes> [--threads n]\n";
+        return 1;
+    }
+    unsigned int threads = 0;
+    if (argc > 5 && !strcmp(argv[4], "--threads")) threads = stoul(argv[5]);
+
+    Movie movie;
+    Keyframes keys;
+    if (!movie.load(argv[2]) || !keys.load(argv[3])) return 1;
+
+    auto start = chrono::steady_clock::now();
+    vector<Keyframes::Segment> segments = keys.verify(movie, threads);
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+    int failed = 0;
+    for (Keyframes::Segment& segment : segments) {
+        if (segment.ok) continue;
+        printf("\nDesync between frames %u and %u", keys.keyFrame(segment.first), keys.keyFrame(segment.last));
+        failed++;
+    }
+    printf("\n%zu segments, %d failed, %.2fs\n", segments.size(), failed, seconds);
+    return failed ? 2 : 0;
+}
+
+// Replay creation: --make-replay <rom> <movie> <replay> [--interval n]
+int makeReplay(int argc, char* argv[])
+{
+    if (argc < 5) {
+        cout << "Usage: --make-replay <rom> <movie> <replay> [--interval n]\n";
+        return 1;
+    }
+    uint32_t interval = 600;
+    if (argc > 6 && !strcmp(argv[5], "--interval")) interval = stoul(argv[6]);
+
+    Movie movie;
+    Console console;
+    if (!movie.load(argv[3]) || !console.powerOn(argv[2])) return 1;
+    if (!Replay::write(argv[4], &console, movie, interval, argv[2])) return 1;
+    return 0;
+}
+
+// Replay seeking: --seek <replay> <frame>
+int seekReplay(int argc, char* argv[])
+{
+    if (argc < 4) {
+        cout << "Usage: --seek <replay> <frame>\n";
+        return 1;
+    }
+    Replay replay;
+    Console console;
+    if (!replay.open(argv[2])) return 1;
+
+    auto start = chrono::steady_clock::now();
+    if (!replay.seek(&console, stoul(argv[3]))) {
+        printf("\nError: cannot seek to frame %s\n", argv[3]);
+        return 1;
+    }
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+    console.cpu->print();
+    printf("\nFrame %s hash %016llx (%.3fs)\n", argv[3], (unsigned long long)console.hash(), seconds);
+    return 0;
+}
+
+// Lockstep batch run: --batch <rom> <movie>, every lane plays the movie with its own pad bits flipped
+int runBatch(int argc, char* argv[])
+{
+    if (argc < 4) {
+        cout << "Usage: --batch <rom> <movie>\n";
+        return 1;
+    }
+    Movie movie;
+    unique_ptr<CPUBatch> batch(new CPUBatch);
+    if (!movie.load(argv[3]) || !batch->powerOn(argv[2])) return 1;
+
+    auto start = chrono::steady_clock::now();
+    uint8_t input[CPUBatch::Lanes];
+    for (uint32_t frame = 0; frame < movie.frameCount(); frame++) {
+        for (int i = 0; i < CPUBatch::Lanes; i++) input[i] = movie.getInput(frame, 0) ^ (i & 1 ? 0x80 : 0);
+        batch->runFrame(input);
+    }
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+    uint64_t lockstep = batch->getLockstepSteps() * CPUBatch::Lanes;
+    uint64_t total = lockstep + batch->getScalarSteps();
+    printf("\n%d lanes x %u frames in %.2fs, %.1f%% of instructions in lockstep\n", CPUBatch::Lanes, movie.frameCount(), seconds, total ? 100.0 * lockstep / total : 0);
+    return 0;
+}
+
+// Watchpoint run: --watch <rom> <movie> <first> <last> <rwx>, addresses in hex
+int watchMovie(int argc, char* argv[])
+{
+    if (argc < 7) {
+        cout << "Usage: --watch <rom> <movie> <first> <last> <rwx>\n";
+        return 1;
+    }
+    uint8_t type = 0;
+    for (const char* c = argv[6]; *c; c++) {
+        if (*c == 'r') type |= WatchRead;
+        else if (*c == 'w') type |= WatchWrite;
+        else if (*c == 'x') type |= WatchExec;
+    }
+
+    Movie movie;
+    Console console;
+    if (!movie.load(argv[3]) || !console.powerOn(argv[2])) return 1;
+    console.mem->addWatch((uint16_t)stoul(argv[4], nullptr, 16), (uint16_t)stoul(argv[5], nullptr, 16), type);
+
+    const char* names[] = { "", "read", "write", "", "exec" };
+    int shown = 0;
+    for (uint32_t frame = 0; frame < movie.frameCount() && shown < 100; frame++) {
+        console.mem->setInput(0, movie.getInput(frame, 0));
+        if (movie.portCount() > 1) console.mem->setInput(1, movie.getInput(frame, 1));
+        while (console.cpu->runFrameDebug()) {
+            for (const WatchHit& hit : console.mem->watchHits()) {
+                if (shown++ < 100) printf("\nFrame %u cycle %u: %s $%04x = %02x", frame, console.cpu->getCycle(), names[hit.type], hit.addr, hit.value);
+            }
+            console.mem->clearHits();
+        }
+    }
+    printf("\n%d watch hits\n", shown);
+    return 0;
+}
+
+// Screenshot: --screenshot <rom> <movie> <frame> <out.ppm>
+int screenshot(int argc, char* argv[])
+{
+    if (argc < 6) {
+        cout << "Usage: --screenshot <rom> <movie> <frame> <out.ppm>\n";
+        return 1;
+    }
+    Movie movie;
+    Console console;
+    if (!movie.load(argv[3]) || !console.powerOn(argv[2])) return 1;
+    uint32_t last = stoul(argv[4]);
+    for (uint32_t frame = 0; frame < last && frame < movie.frameCount(); frame++) movie.runFrame(&console, frame);
+
+    unique_ptr<Frame> frame(new Frame());
+    unique_ptr<Video> video(new Video);
+    vector<uint32_t> rgba(Frame::Width * Frame::Height);
+    console.renderFrame(*frame);
+    video->toRGBA(*frame, rgba.data());
+
+    ofstream out(argv[5], ios::binary);
+    out << "P6\n" << Frame::Width << " " << Frame::Height << "\n255\n";
+    for (uint32_t pixel : rgba) {
+        char rgb[3] = { (char)pixel, (char)(pixel >> 8), (char)(pixel >> 16) };
+        out.write(rgb, 3);
+    }
+    return out ? 0 : 1;
+}
+
+// Video archive: --record-video <rom> <movie> <stream>
+int recordVideo(int argc, char* argv[])
+{
+    if (argc < 5) {
+        cout << "Usage: --record-video <rom> <movie> <stream>\n";
+        return 1;
+    }
+    Movie movie;
+    Console console;
+    FrameWriter writer;
+    if (!movie.load(argv[3]) || !console.powerOn(argv[2]) || !writer.open(argv[4])) return 1;
+
+    auto start = chrono::steady_clock::now();
+    unique_ptr<Frame> frame(new Frame());
+    for (uint32_t f = 0; f < movie.frameCount(); f++) {
+        movie.runFrame(&console, f);
+        console.renderFrame(*frame);
+        writer.push(*frame);
+    }
+    if (!writer.close()) {
+        printf("\nError: cannot write %s\n", argv[4]);
+        return 1;
+    }
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+    uint64_t raw = (uint64_t)writer.frameCount() * Frame::Width * Frame::Height;
+    printf("\n%u frames in %.2fs, %llu bytes (%.3f%% of raw)\n", writer.frameCount(), seconds, (unsigned long long)writer.bytesWritten(), 100.0 * writer.bytesWritten() / raw);
+    return 0;
+}
+
+// Video conversion: --decode-video <stream> <out.rgba>, raw 256x240 RGBA frames
+int decodeVideo(int argc, char* argv[])
+{
+    if (argc < 4) {
+        cout << "Usage: --decode-video <stream> <out.rgba>\n";
+        return 1;
+    }
+    FrameReader reader;
+    if (!reader.open(argv[2])) return 1;
+    ofstream out(argv[3], ios::binary);
+
+    unique_ptr<Frame> frame(new Frame());
+    unique_ptr<Video> video(new Video);
+    vector<uint32_t> rgba(Frame::Width * Frame::Height);
+    uint32_t count = 0;
+    while (reader.next(*frame)) {
+        video->toRGBA(*frame, rgba.data());
+        out.write((char*)rgba.data(), rgba.size() * 4);
+        count++;
+    }
+    printf("\n%u frames decoded\n", count);
+    return out ? 0 : 1;
+}
+
+// Boot template: --make-template <rom> <frames> <template> [--movie m]
+int makeTemplate(int argc, char* argv[])
+{
+    if (argc < 5) {
+        cout << "Usage: --make-template <rom> <frames> <template> [--movie m]\n";
+        return 1;
+    }
+    Movie movie;
+    bool hasMovie = argc > 6 && !strcmp(argv[5], "--movie");
+    if (hasMovie && !movie.load(argv[6])) return 1;
+
+    unique_ptr<Template> boot(new Template);
+    auto start = chrono::steady_clock::now();
+    if (!boot->boot(argv[2], hasMovie ? &movie : nullptr, stoul(argv[3])) || !boot->save(argv[4])) return 1;
+    double booted = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+    // cost of starting a job from the template instead
+    start = chrono::steady_clock::now();
+    for (int i = 0; i < 1000; i++) delete boot->spawn();
+    double spawned = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    printf("\nBooted %u frames in %.3fs, spawn %.2fus per instance\n", boot->bootFrame(), booted, spawned * 1000);
+    return 0;
+}
+
+// Instance pool run: --pool <rom> <movie> <instances> [--huge], every instance plays the movie
+int runPool(int argc, char* argv[])
+{
+    if (argc < 5) {
+        cout << "Usage: --pool <rom> <movie> <instances> [--huge]\n";
+        return 1;
+    }
+    size_t count = stoul(argv[4]);
+    Console::reserve(count, argc > 5 && !strcmp(argv[5], "--huge"));
+
+    Movie movie;
+    if (!movie.load(argv[3])) return 1;
+    vector<unique_ptr<Console>> pool;
+    for (size_t i = 0; i < count; i++) {
+        pool.emplace_back(new Console);
+        if (!pool.back()->powerOn(argv[2])) return 1;
+    }
+
+    auto start = chrono::steady_clock::now();
+    for (uint32_t frame = 0; frame < movie.frameCount(); frame++) {
+        for (auto& console : pool) movie.runFrame(console.get(), frame);
+    }
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    printf("\n%zu instances x %u frames in %.2fs (%.0f fps)\n", count, movie.frameCount(), seconds, count * movie.frameCount() / seconds);
+    return 0;
+}
+
+// Profiling: --profile <rom> <movie> <stacks.folded> [--histogram out.txt]
+int profileMovie(int argc, char* argv[])
+{
+    if (argc < 5) {
+        cout << "Usage: --profile <rom> <movie> <stacks.folded> [--histogram out.txt]\n";
+        return 1;
+    }
+    Movie movie;
+    Console console;
+    if (!movie.load(argv[3]) || !console.powerOn(argv[2])) return 1;
+
+    unique_ptr<Profiler> profiler(new Profiler);
+    console.cpu->setProfiler(profiler.get());
+    auto start = chrono::steady_clock::now();
+    for (uint32_t frame = 0; frame < movie.frameCount(); frame++) movie.runFrame(&console, frame);
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    console.cpu->setProfiler(nullptr);
+
+    if (!profiler->writeCollapsed(argv[4])) return 1;
+    if (argc > 6 && !strcmp(argv[5], "--histogram") && !profiler->writeHistogram(argv[6])) return 1;
+    printf("\n%u frames in %.2fs, %llu cycles profiled\n", movie.frameCount(), seconds, (unsigned long long)profiler->totalCycles());
+    return 0;
+}
+
+// ROM coverage: --coverage <rom> <movie> <log.nesc> [--cdl out.cdl], merges into an existing log
+int coverage(int argc, char* argv[])
+{
+    if (argc < 5) {
+        cout << "Usage: --coverage <rom> <movie> <log.nesc> [--cdl out.cdl]\n";
+        return 1;
+    }
+    Movie movie;
+    Console console;
+    if (!movie.load(argv[3]) || !console.powerOn(argv[2])) return 1;
+
+    unique_ptr<CodeDataLog> log(new CodeDataLog);
+    if (ifstream(argv[4]) && !log->load(argv[4])) return 1;
+    unique_ptr<CodeDataLog> run(new CodeDataLog);
+    console.mem->setLog(run.get());
+    for (uint32_t frame = 0; frame < movie.frameCount(); frame++) movie.runFrame(&console, frame);
+    console.mem->setLog(nullptr);
+
+    log->resize(run->banks() * CodeDataLog::BankSize);
+    if (!log->merge(*run) || !log->save(argv[4])) return 1;
+    if (argc > 6 && !strcmp(argv[5], "--cdl") && !log->exportCDL(argv[6])) return 1;
+    for (size_t bank = 0; bank < log->banks(); bank++) {
+        printf("\nBank %zu: %zu code, %zu operand, %zu data, %zu untouched", bank, log->count(CodeDataLog::Code, bank),
+            log->count(CodeDataLog::Operand, bank), log->count(CodeDataLog::Data, bank), log->untouched(bank));
+    }
+    cout << "\n";
+    return 0;
+}
+
+// CPU conformance vectors: --conformance [--threads n] [--bus] [--pack out.nesx] <vectors...>
+int conformance(int argc, char* argv[])
+{
+    unsigned int threads = 0;
+    bool checkBus = false;
+    const char* packPath = nullptr;
+    Conformance vectors;
+    int files = 0;
+    for (int i = 2; i < argc; i++) {
+        if (!strcmp(argv[i], "--threads") && i + 1 < argc) threads = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "--bus")) checkBus = true;
+        else if (!strcmp(argv[i], "--pack") && i + 1 < argc) packPath = argv[++i];
+        else if (!vectors.load(argv[i])) return 1;
+        else files++;
+    }
+    if (!files) {
+        cout << "Usage: --conformance [--threads n] [--bus] [--pack out.nesx] <vectors.json|.nesx...>\n";
+        return 1;
+    }
+    if (packPath && !vectors.save(packPath)) return 1;
+
+    auto start = chrono::high_resolution_clock::now();
+    vector<Conformance::Failure> failures = vectors.check(checkBus, threads);
+    chrono::duration<double> elapsed = chrono::high_resolution_clock::now() - start;
+
+    // first few diffs, then failures per opcode
+    int opcodeFailures[0x100] = {};
+    for (size_t i = 0; i < failures.size(); i++) {
+        const Conformance::Vector& test = vectors.vector(failures[i].vector);
+        opcodeFailures[strtol(test.name.c_str(), nullptr, 16) & 0xFF]++;
+        if (i < 20) printf("\n%s:%s", test.name.c_str(), failures[i].diff.c_str());
+    }
+    if (failures.size() > 20) printf("\n... %zu more", failures.size() - 20);
+    for (int opcode = 0; opcode < 0x100; opcode++) {
+        if (opcodeFailures[opcode]) printf("\nOpcode %02x: %d failed", opcode, opcodeFailures[opcode]);
+    }
+    printf("\n%zu vectors, %zu failed, %.2fs\n", vectors.count(), failures.size(), elapsed.count());
+    return failures.empty() ? 0 : 2;
+}
+
+// Test ROM regression gate: --test-roms <manifest> [--threads n]
+int testROMs(int argc, char* argv[])
+{
+    if (argc < 3) {
+        cout << "Usage: --test-roms <manifest> [--threads n]\n";
+        return 1;
+    }
+    unsigned int threads = argc > 4 && !strcmp(argv[3], "--threads") ? stoul(argv[4]) : 0;
+    TestROMs suite;
+    if (!suite.load(argv[2])) return 1;
+
+    auto start = chrono::high_resolution_clock::now();
+    vector<TestROMs::Result> results = suite.runAll(threads);
+    chrono::duration<double> elapsed = chrono::high_resolution_clock::now() - start;
+
+    static const char* names[] = { "pass", "FAIL", "TIMEOUT", "NO ROM" };
+    int passed = 0;
+    for (size_t i = 0; i < results.size(); i++) {
+        const TestROMs::Result& result = results[i];
+        passed += result.status == TestROMs::Passed;
+        printf("\n%-7s %s: %u frames, %.2fs, screen %016llx", names[result.status], suite.test(i).rom.c_str(), result.frames,
+            result.seconds, (unsigned long long)result.screen);
+        if (result.status == TestROMs::Failed && !suite.test(i).screen) printf(", code %d", result.code);
+        if (!result.message.empty()) printf("\n    %s", result.message.c_str());
+    }
+    printf("\n%d of %zu passed, %.2fs\n", passed, results.size(), elapsed.count());
+    return passed == (int)results.size() ? 0 : 2;
+}
+
+// RAM search: --ram-search <rom> <movie> <first> <last> <filter[=value]>..., RAM captured every frame from first to last
+int ramSearch(int argc, char* argv[])
+{
+    if (argc < 7) {
+        cout << "Usage: --ram-search <rom> <movie> <first> <last> <filter[=value]>...\n"
+            "  filters: equal=v notequal=v changed unchanged increased decreased delta=v\n";
+        return 1;
+    }
+    static const char* names[] = { "equal", "notequal", "changed", "unchanged", "increased", "decreased", "delta" };
+    Movie movie;
+    Console console;
+    if (!movie.load(argv[3]) || !console.powerOn(argv[2])) return 1;
+    uint32_t first = stoul(argv[4]), last = stoul(argv[5]);
+
+    unique_ptr<RamSearch> search(new RamSearch);
+    for (uint32_t frame = 0; frame <= last && frame < movie.frameCount(); frame++) {
+        movie.runFrame(&console, frame);
+        if (frame >= first) search->capture(&console);
+    }
+
+    for (int i = 6; i < argc; i++) {
+        string name = argv[i];
+        size_t equals = name.find('=');
+        int value = equals == string::npos ? 0 : stoi(name.substr(equals + 1), nullptr, 0);
+        name = name.substr(0, equals);
+        int how = 0;
+        while (how <= RamSearch::Delta && name != names[how]) how++;
+        if (how > RamSearch::Delta) {
+            printf("\nError: unknown filter %s\n", name.c_str());
+            return 1;
+        }
+        printf("\n%s: %zu candidates", argv[i], search->apply(how, (uint8_t)value));
+    }
+    size_t snapshots = search->snapshots();
+    for (uint16_t addr : search->candidates()) {
+        if (!snapshots) break;
+        printf("\n$%04X = %02x", addr, search->value(0, snapshots - 1, addr));
+    }
+    cout << "\n";
+    return 0;
+}
+
+// Rollback netplay over loopback: --netplay <rom> <movie> [--latency n] [--jitter n] [--loss p], ticks are host frames
+int netplay(int argc, char* argv[])
+{
+    if (argc < 4) {
+        cout << "Usage: --netplay <rom> <movie> [--latency n] [--jitter n] [--loss p]\n";
+        return 1;
+    }
+    uint32_t latency = 3, jitter = 0;
+    double loss = 0;
+    for (int i = 4; i + 1 < argc; i++) {
+        if (!strcmp(argv[i], "--latency")) latency = stoul(argv[++i]);
+        else if (!strcmp(argv[i], "--jitter")) jitter = stoul(argv[++i]);
+        else if (!strcmp(argv[i], "--loss")) loss = stod(argv[++i]);
+    }
+    Movie movie;
+    if (!movie.load(argv[3])) return 1;
+    uint32_t frames = movie.frameCount();
+    // player 1 plays the movie's first port, player 2 its buttons mirrored
+    auto input = [&](int port, uint32_t frame) {
+        uint8_t buttons = movie.getInput(frame % frames, 0);
+        if (port == 0) return buttons;
+        uint8_t mirrored = 0;
+        for (int bit = 0; bit < 8; bit++) mirrored |= ((buttons >> bit) & 1) << (7 - bit);
+        return (uint8_t)(mirrored ^ (frame / 7));
+    };
+
+    // the same game without a network, for the confirmed hashes
+    Console reference;
+    if (!reference.powerOn(argv[2])) return 1;
+    vector<uint64_t> expected;
+    for (uint32_t frame = 0; frame < frames; frame++) {
+        expected.push_back(reference.stateHash());
+        reference.mem->setInput(0, input(0, frame));
+        reference.mem->setInput(1, input(1, frame));
+        reference.cpu->runFrame();
+    }
+
+    Loopback link(latency, jitter, loss);
+    Console players[2];
+    unique_ptr<Rollback> sessions[2];
+    for (int port = 0; port < 2; port++) {
+        if (!players[port].powerOn(argv[2])) return 1;
+        sessions[port].reset(new Rollback(&players[port], link.end(port), port));
+    }
+    auto start = chrono::steady_clock::now();
+    while (sessions[0]->confirmedCount() < frames || sessions[1]->confirmedCount() < frames) {
+        for (int port = 0; port < 2; port++) {
+            Rollback& session = *sessions[port];
+            session.advance(input(port, session.frameCount()));
+        }
+        link.tick();
+    }
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+    int result = 0;
+    for (int port = 0; port < 2; port++) {
+        const Rollback::Stats& stats = sessions[port]->statistics();
+        uint32_t wrong = 0;
+        for (uint32_t frame = 0; frame < frames; frame++) wrong += sessions[port]->confirmedHash(frame) != expected[frame];
+        printf("\nPlayer %d: %u host frames, %u stalls, %u rollbacks, depth %u max %.1f mean, %llu frames re-run, %.3fms worst re-run",
+            port + 1, stats.hostFrames, stats.stalls, stats.rollbacks, stats.maxDepth, stats.rollbacks ? (double)stats.resimulated / stats.rollbacks : 0.0,
+            (unsigned long long)stats.resimulated, stats.worstResimSeconds * 1000);
+        if (stats.desyncFrame) printf("\n  Peers disagree at frame %u", stats.desyncFrame);
+        if (wrong) printf("\n  %u confirmed frames differ from the offline run", wrong);
+        if (wrong || stats.desyncFrame) result = 2;
+    }
+    printf("\n%u frames in %.2fs, %s\n", frames, seconds, result ? "out of sync" : "in sync");
+    return result;
+}
+
+int main(int argc, char* argv[])
+{
+    if (argc > 1 && !strcmp(argv[1], "--play")) return playMovie(argc, argv);
+    if (argc > 1 && !strcmp(argv[1], "--record-keys")) return recordKeyframes(argc, argv);
+    if (argc > 1 && !strcmp(argv[1], "--segments")) return verifySegments(argc, argv);
+    if (argc > 1 && !strcmp(argv[1], "--make-replay")) return makeReplay(argc, argv);
+    if (argc > 1 && !strcmp(argv[1], "--seek")) return seekReplay(argc, argv);
+    if (argc > 1 && !strcmp(argv[1], "--batch")) return runBatch(argc, argv);
+    if (argc > 1 && !strcmp(argv[1], "--watch")) return watchMovie(argc, argv);
+    if (argc > 1 && !strcmp(argv[1], "--screenshot")) return screenshot(argc, argv);
+    if (argc > 1 && !strcmp(argv[1], "--record-video")) return recordVideo(argc, argv);
+    if (argc > 1 && !strcmp(argv[1], "--decode-video")) return decodeVideo(argc, argv);
+    if (argc > 1 && !strcmp(argv[1], "--make-template")) return makeTemplate(argc, argv);
+    if (argc > 1 && !strcmp(argv[1], "--pool")) return runPool(argc, argv);
+    if (argc > 1 && !strcmp(argv[1], "--profile")) return profileMovie(argc, argv);
+    if (argc > 1 && !strcmp(argv[1], "--coverage")) return coverage(argc, argv);
+    if (argc > 1 && !strcmp(argv[1], "--conformance")) return conformance(argc, argv);
+    if (argc > 1 && !strcmp(argv[1], "--test-roms")) return testROMs(argc, argv);
+    if (argc > 1 && !strcmp(argv[1], "--ram-search")) return ramSearch(argc, argv);
+    if (argc > 1 && !strcmp(argv[1], "--netplay")) return netplay(argc, argv);
+
     // Load Modules
     MemMap* mem = mem->getInstance();
     CPU* cpu = cpu->getInstance();
@@ -19,6 +617,28 @@ int main()
     cpu->test();
     mem->test();
     mem->clear();
+    unique_ptr<CPUBatch> batch(new CPUBatch);
+    batch->test();
+    unique_ptr<Video> video(new Video);
+    video->test();
+    unique_ptr<FrameReader> stream(new FrameReader);
+    stream->test();
+    unique_ptr<RamSearch> search(new RamSearch);
+    search->test();
+    unique_ptr<Keyframes> keys(new Keyframes);
+    keys->test();
+    unique_ptr<Replay> replay(new Replay);
+    replay->test();
+    unique_ptr<Template> boot(new Template);
+    boot->test();
+    unique_ptr<TestROMs> roms(new TestROMs);
+    roms->test();
+    unique_ptr<Conformance> vectors(new Conformance);
+    vectors->test();
+    unique_ptr<Profiler> profile(new Profiler);
+    profile->test();
+    Rollback::test();
+    testAPI();
 
     // Check legal opcode count
     for (int i = 0; i <= 0xff; i++) {
@@ -27,4 +647,4 @@ int main()
         cpu->execute();
     }
     cout << "\n" << cpu->illegal_opcodes;
-}
\ No newline at end of file
+}
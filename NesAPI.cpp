@@ -0,0 +1,168 @@
+#include <iostream>
+#include <atomic>
+#include <cstdio>
+#include <fstream>
+#include <thread>
+#include "Console.h"
+#include "NesAPI.h"
+
+#ifdef NES_LIBRARY
+MemMap* MemMap::instance = 0;
+CPU* CPU::instance = 0;
+RomCache* RomCache::instance = 0;
+#endif
+
+struct nes_instance {
+	std::unique_ptr<Console> console;
+	std::shared_ptr<const State> boot;	// Power on state, shared by clones
+	Frame frame = {};
+};
+
+// Instances
+nes_instance* nes_create(const char* romPath) {
+	nes_instance* instance = new nes_instance;
+	instance->console.reset(new Console);
+	if (!instance->console->powerOn(romPath)) {
+		delete instance;
+		return nullptr;
+	}
+	State* boot = new State;
+	instance->console->saveState(*boot);
+	instance->boot.reset(boot);
+	return instance;
+}
+nes_instance* nes_clone(nes_instance* instance) {
+	nes_instance* copy = new nes_instance;
+	copy->console.reset(instance->console->fork());
+	copy->boot = instance->boot;
+	copy->frame = instance->frame;
+	return copy;
+}
+void nes_destroy(nes_instance* instance) {
+	delete instance;
+}
+void nes_reset(nes_instance* instance) {
+	instance->console->loadState(*instance->boot);
+}
+
+// Stepping
+static void stepOne(nes_instance* instance, const uint8_t* input, int render) {
+	Console& console = *instance->console;
+	console.mem->setInput(0, input ? input[0] : 0);
+	console.mem->setInput(1, input ? input[1] : 0);
+	console.cpu->runFrame();
+	if (render) console.renderFrame(instance->frame);
+}
+void nes_step(nes_instance* const* instances, size_t count, const uint8_t* inputs, int render, unsigned int threads) {
+	if (threads <= 1 || count <= 1) {
+		for (size_t i = 0; i < count; i++) stepOne(instances[i], inputs ? inputs + i * 2 : nullptr, render);
+		return;
+	}
+
+	std::atomic<size_t> next(0);
+	auto worker = [&]() {
+		for (size_t i = next++; i < count; i = next++) stepOne(instances[i], inputs ? inputs + i * 2 : nullptr, render);
+	};
+	std::vector<std::thread> pool;
+	for (unsigned int i = 1; i < threads && i < count; i++) pool.emplace_back(worker);
+	worker();
+	for (std::thread& thread : pool) thread.join();
+}
+
+// Views
+const uint8_t* nes_ram_page(nes_instance* instance, int page) {
+	if (page < 0 || page >= NES_RAM_PAGES) return nullptr;
+	return instance->console->mem->ramView(page);
+}
+const uint8_t* nes_frame(nes_instance* instance) {
+	return &instance->frame.pixels[0][0];
+}
+uint64_t nes_hash(nes_instance* instance) {
+	return instance->console->hash();
+}
+
+// Test
+void testAPI() {
+	std::cout << "\nTesting Embedding API:";
+
+	// Folds pad 1 into A and counts loops in $10, so the state depends on
+	// the input
+	static const uint8_t program[] = {
+		0xA2, 0x01, 0x8E, 0x16, 0x40, 0xA2, 0x00, 0x8E, 0x16, 0x40,	// $8000 strobe $4016
+		0x6D, 0x16, 0x40, 0x2A, 0x6D, 0x16, 0x40, 0x2A,	// ADC $4016; ROL; ADC $4016; ROL
+		0xE6, 0x10, 0x4C, 0x00, 0x80					// INC $10; JMP $8000
+	};
+	std::vector<uint8_t> file(16 + 0x4000, 0xEA);
+	const uint8_t header[16] = { 'N', 'E', 'S', 0x1A, 1, 0 };
+	std::copy(header, header + 16, file.begin());
+	std::copy(program, program + sizeof(program), file.begin() + 16);
+	file[16 + 0x3FFC] = 0x00;	// reset vector $8000
+	file[16 + 0x3FFD] = 0x80;
+	const char* path = "NesAPI test.nes";
+	std::ofstream(path, std::ios::binary).write((const char*)file.data(), file.size());
+
+	int err_cnt = 0;
+	nes_instance* first = nes_create(path);
+	nes_instance* second = nes_create(path);
+	std::remove(path);
+	if (!first || !second) {
+		printf("\nEmbedding API NOT OK: could not create an instance\n");
+		nes_destroy(first);
+		nes_destroy(second);
+		return;
+	}
+	uint64_t boot = nes_hash(first);
+	std::cout << "\n  Create: ";{
+		if (nes_hash(second) == boot && nes_ram_page(first, 0) && !nes_ram_page(first, NES_RAM_PAGES)) std::cout << "OK";
+		else {
+			std::cout << "Error: instances of one ROM differ at power on";
+			err_cnt++;
+		}
+	}
+	std::cout << "\n  Step: ";{
+		// both at once on two threads, then each on its own, same input
+		const uint8_t inputs[4] = { 0x81, 0x00, 0x81, 0x00 };
+		nes_instance* both[2] = { first, second };
+		for (int frame = 0; frame < 5; frame++) nes_step(both, 2, inputs, 1, 2);
+		bool same = nes_hash(first) == nes_hash(second) && nes_hash(first) != boot;
+		nes_step(both, 1, inputs, 0, 1);
+		nes_step(both + 1, 1, nullptr, 0, 1);
+		if (same && nes_hash(first) != nes_hash(second) && nes_ram_page(first, 0)[0x10] != 0) std::cout << "OK";
+		else {
+			std::cout << "Error: stepping does not follow the input";
+			err_cnt++;
+		}
+	}
+	std::cout << "\n  Clone: ";{
+		// runs on from the same state, without touching the original
+		nes_instance* copy = nes_clone(first);
+		uint64_t before = nes_hash(first);
+		bool same = nes_hash(copy) == before;
+		nes_step(&copy, 1, nullptr, 0, 1);
+		bool kept = nes_hash(first) == before && nes_hash(copy) != before;
+		nes_step(&first, 1, nullptr, 0, 1);
+		if (same && kept && nes_hash(copy) == nes_hash(first)) std::cout << "OK";
+		else {
+			std::cout << "Error: clone does not match or disturbs the original";
+			err_cnt++;
+		}
+		nes_destroy(copy);
+	}
+	std::cout << "\n  Reset: ";{
+		nes_instance* copy = nes_clone(first);
+		nes_reset(first);
+		bool reset = nes_hash(first) == boot && nes_hash(copy) != boot;
+		nes_reset(copy);
+		if (reset && nes_hash(copy) == boot) std::cout << "OK";
+		else {
+			std::cout << "Error: reset does not return to power on";
+			err_cnt++;
+		}
+		nes_destroy(copy);
+	}
+	nes_destroy(first);
+	nes_destroy(second);
+
+	if (err_cnt == 0) std::cout << "\nEmbedding API OK\n";
+	else printf("\nEmbedding API NOT OK: %d errors found\n", err_cnt);
+}
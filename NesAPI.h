@@ -0,0 +1,55 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Embedding API
+// Plain C interface for driving many consoles from another language. Build
+// NesAPI.cpp on its own as a shared library, with NES_LIBRARY defined so it
+// defines the singletons that NES Emulator 2.cpp defines for the executable
+// (NesAPI.vcxproj does this on Windows):
+//   g++ -std=c++14 -O2 -shared -fPIC -pthread -DNES_LIBRARY NesAPI.cpp -o libnes.so
+// The executable links it too, for testAPI().
+// Stepping takes a whole array of instances, so a caller pays the foreign
+// call once per frame rather than once per instance. RAM and the picture are
+// handed out as pointers into the instance, never copied; they stay valid
+// until the instance is stepped, reset or destroyed.
+#ifdef _WIN32
+#define NES_API __declspec(dllexport)
+#else
+#define NES_API __attribute__((visibility("default")))
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct nes_instance nes_instance;
+
+#define NES_RAM_PAGES 8		// Work RAM, 256 byte pages
+#define NES_WIDTH 256		// Picture, one palette index per pixel
+#define NES_HEIGHT 240
+
+// Instances
+NES_API nes_instance* nes_create(const char* romPath);		// null if the ROM cannot be loaded
+NES_API nes_instance* nes_clone(nes_instance* instance);	// shares pages until either side writes
+NES_API void nes_destroy(nes_instance* instance);
+NES_API void nes_reset(nes_instance* instance);			// back to power on
+
+// Stepping
+// Runs every instance for one frame. inputs holds two pad bytes per
+// instance (port 1, port 2), or is null for no buttons. With render set the
+// picture of each instance is drawn at the end of its frame. threads > 1
+// spreads the instances over that many threads.
+NES_API void nes_step(nes_instance* const* instances, size_t count, const uint8_t* inputs, int render, unsigned int threads);
+
+// Views
+NES_API const uint8_t* nes_ram_page(nes_instance* instance, int page);
+NES_API const uint8_t* nes_frame(nes_instance* instance);	// NES_WIDTH x NES_HEIGHT, row major
+NES_API uint64_t nes_hash(nes_instance* instance);
+
+#ifdef __cplusplus
+}
+
+void testAPI();	// Self test, run from the executable
+#endif
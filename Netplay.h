@@ -0,0 +1,345 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <deque>
+#include <iostream>
+#include <random>
+#include "Console.h"
+
+// Netplay Transport
+// Unreliable datagrams between two peers; packets may be lost, late or out
+// of order. Rollback only needs send and a non-blocking receive.
+class Transport {
+public:
+	virtual ~Transport() {}
+	virtual void send(const std::vector<uint8_t>& packet) = 0;
+	virtual bool receive(std::vector<uint8_t>& packet) = 0;	// false when nothing has arrived
+};
+
+// Two connected endpoints in one process, for tests. Time is counted in
+// ticks (host frames), so a run is repeatable: each packet arrives latency
+// plus up to jitter ticks after it was sent, unless dropped at the loss rate.
+class Loopback {
+private:
+	struct Datagram {
+		uint64_t arrival;
+		std::vector<uint8_t> data;
+	};
+	class End : public Transport {
+	public:
+		Loopback* link;
+		int side;
+
+		void send(const std::vector<uint8_t>& packet) {
+			link->post(1 - side, packet);
+		}
+		bool receive(std::vector<uint8_t>& packet) {
+			return link->take(side, packet);
+		}
+	};
+
+	End ends[2];
+	std::deque<Datagram> inbox[2];
+	uint64_t now = 0;
+	uint32_t latency, jitter;
+	double loss;
+	std::mt19937 random;
+
+	void post(int to, const std::vector<uint8_t>& packet) {
+		if (std::uniform_real_distribution<double>(0, 1)(random) < loss) return;
+		uint32_t delay = latency + (jitter ? random() % (jitter + 1) : 0);
+		inbox[to].push_back({ now + delay, packet });
+	}
+	bool take(int side, std::vector<uint8_t>& packet) {
+		// earliest packet that has arrived, so jitter reorders
+		auto first = inbox[side].end();
+		for (auto it = inbox[side].begin(); it != inbox[side].end(); ++it) {
+			if (it->arrival <= now && (first == inbox[side].end() || it->arrival < first->arrival)) first = it;
+		}
+		if (first == inbox[side].end()) return false;
+		packet.swap(first->data);
+		inbox[side].erase(first);
+		return true;
+	}
+
+public:
+	Loopback(uint32_t latencyTicks = 0, uint32_t jitterTicks = 0, double lossRate = 0, uint32_t seed = 1) : latency(latencyTicks), jitter(jitterTicks), loss(lossRate), random(seed) {
+		for (int side = 0; side < 2; side++) {
+			ends[side].link = this;
+			ends[side].side = side;
+		}
+	}
+	Loopback(const Loopback&) = delete;
+	Loopback& operator=(const Loopback&) = delete;
+
+	Transport* end(int side) {
+		return &ends[side];
+	}
+	void tick() {
+		now++;
+	}
+};
+
+// Rollback Session
+// One peer of a two player game. Every host frame the local input is sent
+// and the frame runs at once, using a prediction (the last input heard) for
+// the remote player. When a remote input arrives that differs from what was
+// predicted, the console is rolled back to the snapshot taken before that
+// frame and the frames since are run again with what is now known. Runs
+// never get more than MaxRollback frames ahead of the last confirmed remote
+// input, so a correction never costs more than MaxRollback frames of
+// re-simulation in one host frame; beyond that the session stalls.
+// Packets carry every local input the peer has not acknowledged, so losing
+// one costs nothing once a later one arrives, and the hash of the newest
+// confirmed frame so a desync is caught as soon as both sides have it.
+class Rollback {
+public:
+	static const uint32_t MaxRollback = 8;
+
+	struct Stats {
+		uint32_t hostFrames = 0;
+		uint32_t stalls = 0;			// Host frames spent waiting for the peer
+		uint32_t rollbacks = 0;
+		uint32_t maxDepth = 0;			// Frames re-run by the deepest rollback
+		uint64_t resimulated = 0;		// Frames re-run in total
+		double resimSeconds = 0;
+		double worstResimSeconds = 0;	// Longest re-simulation in one host frame
+		uint32_t desyncFrame = 0;		// First frame whose hash disagreed, 0 for none
+	};
+
+private:
+	struct Snapshot {
+		uint32_t frame;
+		uint64_t hash;	// Console::stateHash()
+		State state;
+	};
+
+	Console* console;
+	Transport* link;
+	int localPort;
+
+	uint32_t frame = 0;					// Next frame to run
+	std::vector<uint8_t> local;			// Local input by frame
+	std::vector<uint8_t> remote;		// Remote input by frame, as received
+	std::vector<uint8_t> predicted;		// Remote input each frame last ran with
+	uint32_t peerHas = 0;				// Local frames the peer has acknowledged
+	uint32_t rollbackTo = UINT32_MAX;	// Earliest mispredicted frame
+	std::unique_ptr<Snapshot> ring[MaxRollback + 1];	// Start of the last frames run, by frame
+	std::vector<uint64_t> confirmed;	// Hash at the start of each frame with all earlier inputs known
+	uint32_t peerCheckFrame = 0;		// Newest confirmed hash heard from the peer
+	uint64_t peerCheckHash = 0;
+	Stats stats;
+
+	Snapshot& slot(uint32_t at) {
+		return *ring[at % (MaxRollback + 1)];
+	}
+	uint8_t prediction() {
+		return remote.empty() ? 0 : remote.back();
+	}
+	void save() {
+		Snapshot& snapshot = slot(frame);
+		snapshot.frame = frame;
+		console->saveState(snapshot.state);
+		snapshot.hash = console->stateHash();
+	}
+	void run() {
+		// one frame from the current state, inputs as best known
+		uint8_t other = frame < remote.size() ? remote[frame] : prediction();
+		if (predicted.size() <= frame) predicted.resize(frame + 1);
+		predicted[frame] = other;
+		console->mem->setInput(localPort, local[frame]);
+		console->mem->setInput(1 - localPort, other);
+		console->cpu->runFrame();
+		frame++;
+		save();
+	}
+
+	// Packets
+	//   first frame (32 bit), count (8 bit), count local inputs, remote
+	//   frames received (32 bit), confirmed frame (32 bit) and its hash
+	static void put32(std::vector<uint8_t>& packet, uint32_t value) {
+		for (int i = 0; i < 4; i++) packet.push_back((uint8_t)(value >> (i * 8)));
+	}
+	static uint32_t get32(const uint8_t* p) {
+		return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+	}
+	void send() {
+		std::vector<uint8_t> packet;
+		uint32_t count = std::min<uint32_t>((uint32_t)local.size() - peerHas, 255);
+		put32(packet, peerHas);
+		packet.push_back((uint8_t)count);
+		packet.insert(packet.end(), local.begin() + peerHas, local.begin() + peerHas + count);
+		put32(packet, (uint32_t)remote.size());
+		uint32_t check = confirmed.empty() ? 0 : (uint32_t)confirmed.size() - 1;
+		uint64_t hash = confirmed.empty() ? 0 : confirmed[check];
+		put32(packet, check);
+		put32(packet, (uint32_t)hash);
+		put32(packet, (uint32_t)(hash >> 32));
+		link->send(packet);
+	}
+	void receive(const std::vector<uint8_t>& packet) {
+		if (packet.size() < 5) return;
+		uint32_t first = get32(&packet[0]);
+		uint32_t count = packet[4];
+		if (packet.size() != 5 + count + 16) return;
+		for (uint32_t at = (uint32_t)remote.size(); at < first + count && at >= first; at++) {
+			uint8_t input = packet[5 + at - first];
+			if (at < frame && predicted[at] != input) rollbackTo = std::min(rollbackTo, at);
+			remote.push_back(input);
+		}
+		const uint8_t* tail = &packet[5 + count];
+		peerHas = std::max(peerHas, std::min(get32(tail), (uint32_t)local.size()));
+		uint32_t check = get32(tail + 4);
+		if (check >= peerCheckFrame) {
+			peerCheckFrame = check;
+			peerCheckHash = get32(tail + 8) | (uint64_t)get32(tail + 12) << 32;
+		}
+	}
+	void confirm() {
+		// snapshots from before the first mispredicted frame, with every
+		// input before them known, can no longer change
+		uint32_t last = std::min(std::min((uint32_t)remote.size(), frame), rollbackTo);
+		while (confirmed.size() <= last && frame - confirmed.size() <= MaxRollback) confirmed.push_back(slot((uint32_t)confirmed.size()).hash);
+		if (!stats.desyncFrame && peerCheckFrame && peerCheckFrame < confirmed.size() && confirmed[peerCheckFrame] != peerCheckHash) stats.desyncFrame = peerCheckFrame;
+	}
+	void resimulate() {
+		auto start = std::chrono::steady_clock::now();
+		uint32_t end = frame;
+		uint32_t depth = end - rollbackTo;
+		console->loadState(slot(rollbackTo).state);
+		frame = rollbackTo;
+		rollbackTo = UINT32_MAX;
+		while (frame < end) run();
+
+		double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+		stats.rollbacks++;
+		stats.maxDepth = std::max(stats.maxDepth, depth);
+		stats.resimulated += depth;
+		stats.resimSeconds += seconds;
+		stats.worstResimSeconds = std::max(stats.worstResimSeconds, seconds);
+	}
+
+public:
+	Rollback(Console* game, Transport* transport, int port) : console(game), link(transport), localPort(port) {
+		for (auto& snapshot : ring) snapshot.reset(new Snapshot());
+		save();
+	}
+
+	// Host Frames
+	bool advance(uint8_t buttons) {
+		// call once per host frame; false if the frame could not run yet
+		stats.hostFrames++;
+		std::vector<uint8_t> packet;
+		while (link->receive(packet)) receive(packet);
+		if (rollbackTo < frame) resimulate();
+		confirm();
+
+		if (frame >= remote.size() + MaxRollback) {
+			stats.stalls++;
+			send();
+			return false;
+		}
+		local.push_back(buttons);
+		send();
+		run();
+		return true;
+	}
+	uint32_t frameCount() {
+		return frame;
+	}
+	uint32_t confirmedCount() {
+		// frames whose start state is final
+		return (uint32_t)confirmed.size();
+	}
+	uint64_t confirmedHash(uint32_t at) {
+		return confirmed[at];
+	}
+	const Stats& statistics() {
+		return stats;
+	}
+
+	static void test() {
+		std::cout << "\nTesting Netplay:";
+
+		// Strobes the pads and folds both of them into A, then into RAM, so
+		// every frame's state depends on all the input so far
+		static const uint8_t program[] = {
+			0xA2, 0x01, 0x8E, 0x16, 0x40, 0xA2, 0x00, 0x8E, 0x16, 0x40,	// $8000 strobe $4016
+			0xA0, 0x08,									// LDY #8
+			0x6D, 0x16, 0x40, 0x2A, 0x6D, 0x17, 0x40, 0x2A,	// $800C ADC $4016; ROL; ADC $4017; ROL
+			0x88, 0xD0, 0xF5,							// DEY; BNE $800C
+			0x8D, 0x00, 0x03, 0xEE, 0x01, 0x03,			// STA $0300; INC $0301
+			0x4C, 0x00, 0x80							// JMP $8000
+		};
+		std::shared_ptr<RomImage> image = std::make_shared<RomImage>();
+		image->mapper = 0;
+		image->vertical = false;
+		image->prg.assign(0x4000, 0xEA);
+		std::copy(program, program + sizeof(program), image->prg.begin());
+		image->prg[0x3FFD] = 0x80;	// reset vector $8000
+		image->prg[0x3FFC] = 0x00;
+		image->hash = hashFinal(hashBytes(image->prg.data(), image->prg.size()));
+
+		// each player holds a pattern for a few frames, so predictions miss
+		const uint32_t frames = 240;
+		auto input = [](int port, uint32_t frame) {
+			return (uint8_t)((frame / (3 + port)) * (0x35 + port * 0x4A));
+		};
+		Console reference;
+		reference.powerOn(image);
+		std::vector<uint64_t> expected;
+		for (uint32_t frame = 0; frame < frames; frame++) {
+			expected.push_back(reference.stateHash());
+			reference.mem->setInput(0, input(0, frame));
+			reference.mem->setInput(1, input(1, frame));
+			reference.cpu->runFrame();
+		}
+
+		int err_cnt = 0;
+		struct Link {
+			const char* name;
+			uint32_t latency, jitter;
+			double loss;
+		};
+		static const Link links[] = { { "Latency", 3, 0, 0 }, { "Jitter and loss", 2, 4, 0.2 } };
+		for (const Link& config : links) {
+			std::cout << "\n  " << config.name << ": ";{
+				Loopback link(config.latency, config.jitter, config.loss);
+				Console players[2];
+				std::unique_ptr<Rollback> sessions[2];
+				for (int port = 0; port < 2; port++) {
+					players[port].powerOn(image);
+					sessions[port].reset(new Rollback(&players[port], link.end(port), port));
+				}
+				for (uint32_t host = 0; host < frames * 4; host++) {
+					if (sessions[0]->confirmedCount() >= frames && sessions[1]->confirmedCount() >= frames) break;
+					for (int port = 0; port < 2; port++) sessions[port]->advance(input(port, sessions[port]->frameCount()));
+					link.tick();
+				}
+
+				int errors = 0;
+				for (int port = 0; port < 2; port++) {
+					Rollback& session = *sessions[port];
+					const Stats& stats = session.statistics();
+					uint32_t wrong = 0;
+					if (session.confirmedCount() < frames) {
+						printf("\n    Player %d: only %u of %u frames confirmed", port + 1, session.confirmedCount(), frames);
+						errors++;
+						continue;
+					}
+					for (uint32_t frame = 0; frame < frames; frame++) wrong += session.confirmedHash(frame) != expected[frame];
+					if (wrong || stats.desyncFrame || !stats.rollbacks || stats.maxDepth > MaxRollback) {
+						printf("\n    Player %d: %u frames differ, desync at %u, %u rollbacks, depth %u", port + 1, wrong, stats.desyncFrame, stats.rollbacks, stats.maxDepth);
+						errors++;
+					}
+				}
+				if (errors == 0) std::cout << "OK";
+				err_cnt += errors;
+			}
+		}
+
+		if (err_cnt == 0) std::cout << "\nNetplay OK\n";
+		else printf("\nNetplay NOT OK: %d errors found\n", err_cnt);
+	}
+};
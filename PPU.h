@@ -0,0 +1,312 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include "Hash.h"
+
+// Palette-indexed picture, one 6-bit NES colour per pixel. Conversion to
+// RGB is left to whoever actually looks at the frame (see Video.h).
+struct Frame {
+	static const int Width = 256;
+	static const int Height = 240;
+	uint8_t pixels[Height][Width];
+	uint8_t emphasis;	// PPUMASK colour emphasis bits (red, green, blue)
+};
+
+// Picture Processing Unit registers and video memory
+// Frames start at VBlank; the pre-render line clears it 20 scanlines later.
+// The flag is settled lazily from the CPU cycle when $2002 is read.
+class PPU {
+private:
+	// Registers
+	uint8_t ctrl = 0;			// $2000 PPUCTRL
+	uint8_t mask = 0;			// $2001 PPUMASK
+	uint8_t status = 0;			// $2002 PPUSTATUS
+	uint8_t oamAddr = 0;		// $2003 OAMADDR
+	uint8_t bus = 0;			// I/O latch, returned by write-only registers
+	uint8_t readBuffer = 0;		// $2007 delayed read
+	uint16_t v = 0;				// Current VRAM address
+	uint16_t t = 0;				// Temporary VRAM address
+	uint8_t fineX = 0;			// Fine X scroll
+	bool latch = false;			// $2005/$2006 first or second write
+	unsigned int vblankEnd = 0;	// CPU cycle of the pre-render line
+
+	// Video Memory
+	// 256 byte pages held by the memory map, which shares them between
+	// forked instances and makes one private before any write reaches it.
+	// The pointers are process-local and not part of saved state. Pattern
+	// tables are the shared CHR ROM or else CHR RAM pages.
+	uint8_t* ciram[0x08] = {};		// Nametables
+	uint8_t* palette = nullptr;		// 32 entries at the start of a page
+	const uint8_t* chrROM = nullptr;
+	uint8_t* chrRAM[0x20] = {};
+	bool vertical = false;			// Nametable mirroring
+
+	uint8_t& name(uint16_t addr) {
+		uint16_t offset = nametable(addr);
+		return ciram[offset >> 8][offset & 0xFF];
+	}
+	static int paletteIndex(uint16_t addr) {
+		// $3F10/$3F14/$3F18/$3F1C mirror the backdrop entries
+		int index = addr & 0x1F;
+		if ((index & 0x13) == 0x10) index &= 0x0F;
+		return index;
+	}
+	uint8_t pattern(uint16_t addr) {
+		return chrROM ? chrROM[addr] : chrRAM[addr >> 8][addr & 0xFF];
+	}
+	void increment() {
+		v = (v + (ctrl & 0x04 ? 32 : 1)) & 0x7FFF;
+	}
+
+	// Rendering
+	void renderBackground(int y, uint8_t* line) {
+		// palette entry per pixel (0 = transparent) for 33 tiles from the
+		// scroll origin in t; the caller skips the first fineX pixels
+		int worldY = (((t >> 11) & 0x01) * 240 + ((t >> 5) & 0x1F) * 8 + ((t >> 12) & 0x07) + y) % 480;
+		int tableY = worldY / 240;
+		int row = worldY % 240;
+		uint16_t base = ctrl & 0x10 ? 0x1000 : 0x0000;
+		int tileX = ((t >> 10) & 0x01) * 32 + (t & 0x1F);
+		for (int tile = 0; tile < 33; tile++, tileX++) {
+			int column = tileX & 0x1F;
+			uint16_t table = 0x2000 + ((((tileX >> 5) & 0x01) | (tableY << 1)) * 0x400);
+			uint8_t tileName = name(table + (row / 8) * 32 + column);
+			uint8_t attribute = name(table + 0x3C0 + (row / 32) * 8 + column / 4);
+			int shift = ((row & 0x10) >> 2) | (column & 0x02);
+			uint8_t select = ((attribute >> shift) & 0x03) << 2;
+
+			uint8_t low = pattern(base + tileName * 16 + (row & 0x07));
+			uint8_t high = pattern(base + tileName * 16 + (row & 0x07) + 8);
+			for (int bit = 0; bit < 8; bit++) {
+				uint8_t colour = ((low >> (7 - bit)) & 0x01) | (((high >> (7 - bit)) & 0x01) << 1);
+				line[tile * 8 + bit] = colour ? select | colour : 0;
+			}
+		}
+	}
+	void renderSprites(int y, uint8_t* line, bool* behind) {
+		// first 8 sprites on the line, lower OAM index wins
+		int height = ctrl & 0x20 ? 16 : 8;
+		int found = 0;
+		for (int i = 0; i < 64 && found < 8; i++) {
+			const uint8_t* sprite = oam + i * 4;
+			int row = y - (sprite[0] + 1);
+			if (row < 0 || row >= height) continue;
+			found++;
+
+			if (sprite[2] & 0x80) row = height - 1 - row;	// vertical flip
+			uint16_t address;
+			if (height == 16) address = ((sprite[1] & 0x01) << 12) + (sprite[1] & 0xFE) * 16 + (row & 0x08) * 2 + (row & 0x07);
+			else address = (ctrl & 0x08 ? 0x1000 : 0x0000) + sprite[1] * 16 + row;
+			uint8_t low = pattern(address);
+			uint8_t high = pattern(address + 8);
+			for (int bit = 0; bit < 8; bit++) {
+				int x = sprite[3] + bit;
+				if (x >= Frame::Width || line[x]) continue;
+				int shift = sprite[2] & 0x40 ? bit : 7 - bit;		// horizontal flip
+				uint8_t colour = ((low >> shift) & 0x01) | (((high >> shift) & 0x01) << 1);
+				if (!colour) continue;
+				line[x] = 0x10 | ((sprite[2] & 0x03) << 2) | colour;
+				behind[x] = (sprite[2] & 0x20) != 0;
+			}
+		}
+	}
+
+public:
+	uint8_t* oam = nullptr;		// Sprite memory, one page (see Video Memory)
+
+	// Emulator Utilities
+	void clear() {
+		*this = PPU();
+	}
+	void loadCHR(bool verticalMirroring) {
+		vertical = verticalMirroring;
+	}
+	void attachMemory(uint8_t* const* names, uint8_t* colours, uint8_t* sprites) {
+		// null everything to detach a snapshot from this process
+		for (int i = 0; i < 0x08; i++) ciram[i] = names ? names[i] : nullptr;
+		palette = colours;
+		oam = sprites;
+	}
+	void attachCHR(const uint8_t* rom, uint8_t* const* ram) {
+		// the CHR ROM, or else 32 pages of CHR RAM; the caller makes a page
+		// private before any write can reach it
+		chrROM = rom;
+		for (int i = 0; i < 0x20; i++) chrRAM[i] = ram ? ram[i] : nullptr;
+	}
+	void beginFrame(unsigned int cycle) {
+		status |= 0x80;
+		vblankEnd = cycle + 20 * 341 / 3;
+	}
+	void sync(unsigned int cycle) {
+		// pre-render line clears VBlank, sprite 0 hit and overflow
+		if ((int)(cycle - vblankEnd) >= 0) status &= 0x1F;
+	}
+	bool nmiOutput(unsigned int cycle) {
+		// level the CPU's NMI input sees: VBlank with NMI enabled
+		sync(cycle);
+		return (status & ctrl & 0x80) != 0;
+	}
+
+	// Video Memory
+	uint8_t readVRAM(uint16_t addr) {
+		addr &= 0x3FFF;
+		if (addr < 0x2000) return pattern(addr);
+		if (addr < 0x3F00) return name(addr);
+		return palette[paletteIndex(addr)];
+	}
+	void writeVRAM(uint16_t addr, uint8_t value) {
+		addr &= 0x3FFF;
+		if (addr < 0x2000) {
+			if (!chrROM) chrRAM[addr >> 8][addr & 0xFF] = value;
+		}
+		else if (addr < 0x3F00) name(addr) = value;
+		else palette[paletteIndex(addr)] = value & 0x3F;
+	}
+	void render(Frame& frame) {
+		// Draws the whole picture from the registers as they stand, so it
+		// costs nothing until asked for. Mid-frame scroll and bank changes
+		// are not seen; sprite 0 hit and overflow are not reported.
+		uint8_t background[Frame::Width + 8];
+		uint8_t sprites[Frame::Width];
+		bool behind[Frame::Width];
+		uint8_t greyscale = mask & 0x01 ? 0x30 : 0x3F;
+		for (int y = 0; y < Frame::Height; y++) {
+			memset(background, 0, sizeof(background));
+			memset(sprites, 0, sizeof(sprites));
+			if (mask & 0x08) renderBackground(y, background);
+			if (mask & 0x10) renderSprites(y, sprites, behind);
+
+			uint8_t* out = frame.pixels[y];
+			for (int x = 0; x < Frame::Width; x++) {
+				uint8_t back = x >= 8 || mask & 0x02 ? background[x + fineX] : 0;
+				uint8_t front = x >= 8 || mask & 0x04 ? sprites[x] : 0;
+				uint8_t entry = front && (!back || !behind[x]) ? front : back;
+				out[x] = palette[paletteIndex(entry)] & greyscale;
+			}
+		}
+		frame.emphasis = mask >> 5;
+	}
+	void dma(const uint8_t* page) {
+		// 256 bytes into OAM, starting at OAMADDR
+		memcpy(oam + oamAddr, page, 0x100 - oamAddr);
+		memcpy(oam, page + 0x100 - oamAddr, oamAddr);
+	}
+
+	// Register Reads
+	uint8_t openBus() {
+		return bus;
+	}
+	uint8_t readStatus(unsigned int cycle) {
+		// reading clears VBlank and the write toggle
+		sync(cycle);
+		bus = (status & 0xE0) | (bus & 0x1F);
+		status &= 0x7F;
+		latch = false;
+		return bus;
+	}
+	uint8_t readOAMData() {
+		return bus = oam[oamAddr];
+	}
+	uint8_t readData() {
+		// VRAM reads lag one read behind; palette reads are immediate
+		uint16_t addr = v & 0x3FFF;
+		increment();
+		if (addr >= 0x3F00) {
+			bus = (bus & 0xC0) | readVRAM(addr);
+			readBuffer = readVRAM(addr - 0x1000);
+		}
+		else {
+			bus = readBuffer;
+			readBuffer = readVRAM(addr);
+		}
+		return bus;
+	}
+
+	// Register Writes
+	void writeCtrl(uint8_t value) {
+		bus = ctrl = value;
+		t = (t & 0xF3FF) | ((value & 0x03) << 10);
+	}
+	void writeMask(uint8_t value) {
+		bus = mask = value;
+	}
+	void writeBus(uint8_t value) {
+		// $2002 is read only, the write only reaches the latch
+		bus = value;
+	}
+	void writeOAMAddr(uint8_t value) {
+		bus = oamAddr = value;
+	}
+	void writeOAMData(uint8_t value) {
+		bus = value;
+		oam[oamAddr++] = value;
+	}
+	void writeScroll(uint8_t value) {
+		bus = value;
+		if (!latch) {
+			t = (t & 0xFFE0) | (value >> 3);
+			fineX = value & 0x07;
+		}
+		else t = (t & 0x8C1F) | ((value & 0x07) << 12) | ((value & 0xF8) << 2);
+		latch = !latch;
+	}
+	void writeAddr(uint8_t value) {
+		bus = value;
+		if (!latch) t = (t & 0x00FF) | ((value & 0x3F) << 8);
+		else {
+			t = (t & 0xFF00) | value;
+			v = t;
+		}
+		latch = !latch;
+	}
+	void writeData(uint8_t value) {
+		bus = value;
+		writeVRAM(v, value);
+		increment();
+	}
+	uint16_t vramAddress() {
+		// where the next $2007 access goes
+		return v & 0x3FFF;
+	}
+	uint16_t nametable(uint16_t addr) {
+		// offset into the 2KB of nametables after mirroring
+		if (vertical) return addr & 0x07FF;
+		return ((addr >> 1) & 0x0400) | (addr & 0x03FF);
+	}
+
+	// State Hashing
+	// Memory is hashed by region so callers can skip regions not written
+	// since; the pattern table is only state on CHR RAM carts.
+	uint64_t hashNames(uint64_t h) {
+		for (uint8_t* page : ciram) h = hashWords(page, 0x100, h);
+		return hashWords(palette, 0x20, h);
+	}
+	uint64_t hashPatterns(uint64_t h) {
+		if (chrROM) return h;
+		for (uint8_t* page : chrRAM) h = hashWords(page, 0x100, h);
+		return h;
+	}
+	uint64_t hashSprites(uint64_t h) {
+		return hashWords(oam, 0x100, h);
+	}
+	uint64_t hashRegisters(uint64_t h) {
+		h = hashMix(h, ctrl | mask << 8 | status << 16 | (uint32_t)oamAddr << 24 | (uint64_t)bus << 32 | (uint64_t)readBuffer << 40 | (uint64_t)fineX << 48 | (uint64_t)latch << 56);
+		h = hashMix(h, v | (uint32_t)t << 16 | (uint64_t)vertical << 32);
+		return hashMix(h, vblankEnd);
+	}
+	bool sameAs(const PPU& other) {
+		return ctrl == other.ctrl && mask == other.mask && status == other.status && oamAddr == other.oamAddr && bus == other.bus &&
+			readBuffer == other.readBuffer && v == other.v && t == other.t && fineX == other.fineX && latch == other.latch &&
+			vblankEnd == other.vblankEnd && vertical == other.vertical && samePages(ciram, other.ciram, 0x08) &&
+			!memcmp(palette, other.palette, 0x20) && samePages(&oam, &other.oam, 1) &&
+			(chrROM || samePages(chrRAM, other.chrRAM, 0x20));
+	}
+	static bool samePages(uint8_t* const* pages, uint8_t* const* other, int count) {
+		// pages still shared are skipped
+		for (int i = 0; i < count; i++) {
+			if (pages[i] != other[i] && memcmp(pages[i], other[i], 0x100)) return false;
+		}
+		return true;
+	}
+};
@@ -0,0 +1,199 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// 6502 Profiler
+// Counts the cycles of every instruction against its PC and against the
+// routine it runs in. Routines form a call tree built from JSR/RTS, BRK/RTI
+// and hardware interrupts; the current tree node is kept up to date as calls
+// happen, so counting is two adds per instruction and no stack walks.
+// Output is a per-PC histogram and collapsed stacks for flamegraph.pl.
+class Profiler {
+public:
+	enum callType {
+		Call, Break, NMI, IRQ
+	};
+
+private:
+	// Call Tree
+	struct Node {
+		uint32_t parent;
+		uint16_t target;	// Routine entry point
+		int8_t bank;		// 8KB PRG bank at the entry point, -1 outside ROM
+		uint8_t type;
+		uint64_t cycles;	// Spent in this routine itself, not its callees
+	};
+	struct Frame {
+		uint32_t node;
+		uint8_t sp;			// Stack pointer before the return address went on
+	};
+	std::vector<Node> nodes;
+	std::unordered_map<uint64_t, uint32_t> children;	// parent, type, bank, target -> node
+	std::vector<Frame> stack;
+	uint32_t current = 0;
+
+	// Histogram
+	std::vector<uint64_t> pcCycles;
+	std::vector<uint32_t> pcCount;
+
+	uint32_t child(uint32_t parent, uint16_t target, int bank, uint8_t type) {
+		uint64_t key = ((uint64_t)parent << 32) | ((uint32_t)type << 24) | ((uint32_t)(uint8_t)bank << 16) | target;
+		auto found = children.find(key);
+		if (found != children.end()) return found->second;
+		uint32_t node = (uint32_t)nodes.size();
+		nodes.push_back({ parent, target, (int8_t)bank, type, 0 });
+		children[key] = node;
+		return node;
+	}
+	std::string name(const Node& node) {
+		static const char* types[] = { "", "brk ", "nmi ", "irq " };
+		char text[24];
+		if (node.bank < 0) snprintf(text, sizeof(text), "%s$%04X", types[node.type], node.target);
+		else snprintf(text, sizeof(text), "%s$%04X@%d", types[node.type], node.target, node.bank);
+		return text;
+	}
+
+public:
+	Profiler() {
+		clear();
+	}
+
+	// Recording
+	void clear() {
+		nodes.assign(1, { 0, 0, -1, Call, 0 });
+		children.clear();
+		stack.clear();
+		current = 0;
+		pcCycles.assign(0x10000, 0);
+		pcCount.assign(0x10000, 0);
+	}
+	void count(uint16_t pc, unsigned int cycles) {
+		pcCycles[pc] += cycles;
+		pcCount[pc]++;
+		nodes[current].cycles += cycles;
+	}
+	void charge(unsigned int cycles) {
+		// cycles outside any instruction, such as interrupt entry
+		nodes[current].cycles += cycles;
+	}
+	void call(uint16_t target, int bank, uint8_t sp, uint8_t type = Call) {
+		stack.push_back({ current, sp });
+		current = child(current, target, bank, type);
+	}
+	void ret(uint8_t sp) {
+		// unwinds every frame the stack pointer has moved back past, so
+		// RTS used as a jump or stack resets leave the tree consistent
+		while (!stack.empty() && stack.back().sp <= sp) {
+			current = stack.back().node;
+			stack.pop_back();
+		}
+	}
+	void merge(Profiler& other) {
+		// adds another run's counts, matching routines by call path
+		std::vector<uint32_t> map(other.nodes.size(), 0);
+		for (uint32_t i = 1; i < other.nodes.size(); i++) {
+			const Node& node = other.nodes[i];
+			map[i] = child(map[node.parent], node.target, node.bank, node.type);
+		}
+		for (uint32_t i = 0; i < other.nodes.size(); i++) nodes[map[i]].cycles += other.nodes[i].cycles;
+		for (int pc = 0; pc < 0x10000; pc++) {
+			pcCycles[pc] += other.pcCycles[pc];
+			pcCount[pc] += other.pcCount[pc];
+		}
+	}
+	uint64_t totalCycles() {
+		uint64_t total = 0;
+		for (const Node& node : nodes) total += node.cycles;
+		return total;
+	}
+
+	// Output
+	void collapsed(std::ostream& out) {
+		// one "root;caller;callee cycles" line per routine on a call path
+		std::vector<std::string> paths(nodes.size());
+		paths[0] = "main";
+		for (uint32_t i = 1; i < nodes.size(); i++) paths[i] = paths[nodes[i].parent] + ";" + name(nodes[i]);
+		for (uint32_t i = 0; i < nodes.size(); i++) {
+			if (nodes[i].cycles) out << paths[i] << " " << nodes[i].cycles << "\n";
+		}
+	}
+	bool writeCollapsed(const char* path) {
+		std::ofstream file(path);
+		collapsed(file);
+		if (!file) printf("\nError: cannot write %s\n", path);
+		return (bool)file;
+	}
+	bool writeHistogram(const char* path) {
+		// "PC cycles instructions", busiest first
+		std::ofstream file(path);
+		std::vector<int> order;
+		for (int pc = 0; pc < 0x10000; pc++) {
+			if (pcCount[pc]) order.push_back(pc);
+		}
+		std::sort(order.begin(), order.end(), [this](int a, int b) { return pcCycles[a] > pcCycles[b]; });
+		char line[48];
+		for (int pc : order) {
+			snprintf(line, sizeof(line), "$%04X %llu %u\n", pc, (unsigned long long)pcCycles[pc], pcCount[pc]);
+			file << line;
+		}
+		if (!file) printf("\nError: cannot write %s\n", path);
+		return (bool)file;
+	}
+
+	void test() {
+		std::cout << "\nTesting Profiler:";
+
+		int err_cnt = 0;
+		std::cout << "\n  Call tree: ";{
+			// main JSRs $9000, which JSRs $A000 and resets the stack from
+			// there; the IRQ comes back with RTI
+			clear();
+			count(0x8000, 6);
+			call(0x9000, 0, 0xFD);
+			count(0x9000, 3);
+			call(0xA000, 1, 0xFB);
+			count(0xA000, 4);
+			ret(0xFD);				// both frames unwind at once
+			count(0x8003, 2);
+			call(0xC000, -1, 0xFD, IRQ);
+			charge(7);
+			count(0xC000, 6);
+			ret(0xFD);
+			count(0x8005, 2);
+			call(0x9000, 0, 0xFD);	// the same path finds the same node
+			count(0x9000, 3);
+			ret(0xFD);
+			std::ostringstream out;
+			collapsed(out);
+			const char* expected = "main 10\nmain;$9000@0 6\nmain;$9000@0;$A000@1 4\nmain;irq $C000 13\n";
+			if (out.str() == expected && totalCycles() == 33 && pcCycles[0x9000] == 6 && pcCount[0x9000] == 2) std::cout << "OK";
+			else {
+				std::cout << "Error: got\n" << out.str();
+				err_cnt++;
+			}
+		}
+		std::cout << "\n  Merge: ";{
+			Profiler other;
+			other.call(0x9000, 0, 0xFD);
+			other.count(0x9000, 5);
+			merge(other);
+			if (totalCycles() == 38 && nodes.size() == 4 && pcCount[0x9000] == 3) std::cout << "OK";
+			else {
+				printf("Error: %llu cycles in %u routines", (unsigned long long)totalCycles(), (unsigned)nodes.size());
+				err_cnt++;
+			}
+		}
+		clear();
+
+		if (err_cnt == 0) std::cout << "\nProfiler OK\n";
+		else printf("\nProfiler NOT OK: %d errors found\n", err_cnt);
+	}
+};
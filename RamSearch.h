@@ -0,0 +1,185 @@
+#pragma once
+
+#include <emmintrin.h>
+#include <random>
+#include "Console.h"
+
+// RAM Search
+// Narrows down which work RAM addresses hold a value of interest by
+// capturing RAM over many frames, from one or more instances (series), and
+// keeping only the addresses whose history passes each filter in turn.
+// Snapshots are stored column-wise in blocks of 16: for every address the
+// 16 snapshots of a block are one SSE2 vector, the same interleaving as
+// CPUBatch's RAM. A filter then tests 16 frames of one address per compare,
+// and an address is dropped at its first failing block.
+class RamSearch {
+public:
+	static const int Size = 0x0800;
+	static const int Lanes = 16;
+
+	enum filter {
+		Equal,		// Every snapshot == value
+		NotEqual,	// Every snapshot != value
+		Changed,	// Every snapshot differs from the one before
+		Unchanged,	// Every snapshot matches the one before
+		Increased,	// Every snapshot is above the one before (unsigned)
+		Decreased,	// Every snapshot is below the one before (unsigned)
+		Delta		// Every snapshot minus the one before == value (wrapping)
+	};
+
+private:
+	struct Block {
+		uint8_t ram[Size][Lanes];
+	};
+	struct Series {
+		std::vector<std::unique_ptr<Block>> blocks;
+		size_t count = 0;	// Snapshots captured
+	};
+	std::vector<Series> series;
+	std::vector<uint16_t> alive;	// Candidate addresses, ascending
+
+	static __m128i load(const uint8_t* p) {
+		return _mm_loadu_si128((const __m128i*)p);
+	}
+	static __m128i splat(uint8_t value) {
+		return _mm_set1_epi8((char)value);
+	}
+	static int pass(int how, __m128i now, __m128i before, __m128i value) {
+		// one bit per lane that passes
+		__m128i same = _mm_cmpeq_epi8(now, before);
+		switch (how) {
+		case Equal: return _mm_movemask_epi8(_mm_cmpeq_epi8(now, value));
+		case NotEqual: return ~_mm_movemask_epi8(_mm_cmpeq_epi8(now, value)) & 0xFFFF;
+		case Changed: return ~_mm_movemask_epi8(same) & 0xFFFF;
+		case Unchanged: return _mm_movemask_epi8(same);
+		case Increased: return ~_mm_movemask_epi8(_mm_or_si128(same, _mm_cmpeq_epi8(_mm_max_epu8(now, before), before))) & 0xFFFF;
+		case Decreased: return ~_mm_movemask_epi8(_mm_or_si128(same, _mm_cmpeq_epi8(_mm_min_epu8(now, before), before))) & 0xFFFF;
+		case Delta: return _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_sub_epi8(now, before), value));
+		}
+		return 0;
+	}
+	static bool keep(const Series& run, int how, uint16_t addr, __m128i value) {
+		// every snapshot of one address in one series
+		bool pairwise = how != Equal && how != NotEqual;
+		__m128i carry = _mm_setzero_si128();	// Previous block, for its last lane
+		for (size_t b = 0; b < run.blocks.size(); b++) {
+			__m128i now = load(run.blocks[b]->ram[addr]);
+			// lane i compares with lane i - 1; lane 0 with the last of the previous block
+			__m128i before = _mm_or_si128(_mm_slli_si128(now, 1), _mm_srli_si128(carry, 15));
+			carry = now;
+
+			size_t first = b * Lanes, last = std::min(first + Lanes, run.count);
+			int lanes = (1 << (last - first)) - 1;
+			if (pairwise && b == 0) lanes &= ~1;	// first snapshot has nothing before it
+			if ((pass(how, now, before, value) & lanes) != lanes) return false;
+		}
+		return true;
+	}
+
+public:
+	RamSearch() {
+		reset();
+	}
+
+	// Capture
+	void capture(const uint8_t* ram, size_t index = 0) {
+		// one 2KB snapshot of work RAM into series index
+		if (index >= series.size()) series.resize(index + 1);
+		Series& run = series[index];
+		if (run.count % Lanes == 0) run.blocks.emplace_back(new Block());
+		Block& block = *run.blocks.back();
+		size_t lane = run.count++ % Lanes;
+		for (int addr = 0; addr < Size; addr++) block.ram[addr][lane] = ram[addr];
+	}
+	void capture(Console* console, size_t index = 0) {
+		uint8_t ram[Size];
+		for (int page = 0; page < Size / 0x100; page++) memcpy(ram + page * 0x100, console->mem->ramView(page), 0x100);
+		capture(ram, index);
+	}
+	void clear() {
+		// drops the snapshots, keeping the candidates
+		series.clear();
+	}
+	size_t snapshots(size_t index = 0) {
+		return index < series.size() ? series[index].count : 0;
+	}
+	uint8_t value(size_t index, size_t snapshot, uint16_t addr) {
+		return series[index].blocks[snapshot / Lanes]->ram[addr][snapshot % Lanes];
+	}
+
+	// Filtering
+	void reset() {
+		// every address a candidate again
+		alive.resize(Size);
+		for (int addr = 0; addr < Size; addr++) alive[addr] = (uint16_t)addr;
+	}
+	size_t apply(int how, uint8_t value = 0) {
+		// keeps the candidates that pass in every series
+		__m128i wanted = splat(value);
+		size_t kept = 0;
+		for (uint16_t addr : alive) {
+			bool ok = true;
+			for (const Series& run : series) {
+				if (!keep(run, how, addr, wanted)) {
+					ok = false;
+					break;
+				}
+			}
+			if (ok) alive[kept++] = addr;
+		}
+		alive.resize(kept);
+		return kept;
+	}
+	const std::vector<uint16_t>& candidates() {
+		return alive;
+	}
+
+	void test() {
+		std::cout << "\nTesting RAM Search:";
+
+		// filters against a byte at a time check on random histories
+		int err_cnt = 0;
+		std::mt19937 random(45);
+		for (int how = Equal; how <= Delta; how++) {
+			clear();
+			reset();
+			std::vector<std::vector<uint8_t>> history(37, std::vector<uint8_t>(Size));
+			for (size_t s = 0; s < history.size(); s++) {
+				for (int addr = 0; addr < Size; addr++) {
+					// mostly steady, rising, or noisy columns so each filter keeps some
+					uint8_t step = addr % 4 == 0 ? 0 : addr % 4 == 1 ? 3 : (uint8_t)random();
+					history[s][addr] = s ? history[s - 1][addr] + step : (uint8_t)(addr % 4 < 2 ? 3 : random());
+				}
+				capture(history[s].data());
+			}
+			apply(how, 3);
+
+			std::vector<uint16_t> expected;
+			for (int addr = 0; addr < Size; addr++) {
+				bool ok = true;
+				for (size_t s = 0; s < history.size(); s++) {
+					uint8_t now = history[s][addr], before = s ? history[s - 1][addr] : 0;
+					bool pairwise = how != Equal && how != NotEqual;
+					if (pairwise && s == 0) continue;
+					if (how == Equal) ok &= now == 3;
+					if (how == NotEqual) ok &= now != 3;
+					if (how == Changed) ok &= now != before;
+					if (how == Unchanged) ok &= now == before;
+					if (how == Increased) ok &= now > before;
+					if (how == Decreased) ok &= now < before;
+					if (how == Delta) ok &= (uint8_t)(now - before) == 3;
+				}
+				if (ok) expected.push_back((uint16_t)addr);
+			}
+			if (expected != alive) {
+				printf("\nFilter %d: expected %zu candidates, got %zu", how, expected.size(), alive.size());
+				err_cnt++;
+			}
+		}
+		clear();
+		reset();
+
+		if (err_cnt == 0) std::cout << "\nRAM Search OK\n";
+		else printf("\nRAM Search NOT OK: %d errors found\n", err_cnt);
+	}
+};
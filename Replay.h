@@ -0,0 +1,264 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdio>
+#include <iostream>
+#include <memory>
+#include "MappedFile.h"
+#include "Movie.h"
+#include "RunLength.h"
+
+// Seekable Replay (.nesr)
+//   Header | ROM path | input stream (one byte per port per frame)
+//   | compressed keyframes | keyframe index | footer
+// Keyframe 0 is the power on state; every later keyframe is stored as its XOR
+// against keyframe 0, so unchanged regions (ROM, idle RAM) pack down to a few
+// bytes. The fixed size index and footer at the end are read in place from a
+// memory mapping, so seeking touches only the keyframe it restores. The
+// replay is bound to its ROM by path and content hash, and seeking powers
+// the console on with that ROM before restoring a keyframe.
+class Replay {
+private:
+	struct Header {
+		char magic[4];		// "NESR"
+		uint8_t version;
+		uint8_t ports;
+		uint16_t reserved;
+		uint32_t interval;	// Frames between keyframes
+		uint32_t frames;	// Frames of input
+		uint32_t stateSize;	// sizeof(State) when written
+		uint32_t pathLength;	// ROM path, following the header
+		uint64_t romHash;		// RomImage::hash
+	};
+	struct IndexEntry {
+		uint64_t offset;	// Compressed keyframe position in file
+		uint64_t hash;		// Console::hash() of state
+		uint32_t frame;		// Frames completed
+		uint32_t size;		// Compressed keyframe length
+	};
+	struct Footer {
+		uint64_t indexOffset;
+		uint32_t count;
+		char magic[4];		// "NESI"
+	};
+
+	MappedFile file;
+	Header header;
+	const uint8_t* input = nullptr;
+	const IndexEntry* index = nullptr;
+	uint32_t keyCount = 0;
+	std::vector<uint8_t> base;	// Decoded keyframe 0
+	std::shared_ptr<const RomImage> rom;
+
+	bool decodeKey(uint32_t key, State& state) {
+		const IndexEntry& entry = index[key];
+		if (entry.offset + entry.size > file.size()) return false;
+
+		uint8_t* raw = (uint8_t*)&state;
+		if (!unpackRuns(file.begin() + entry.offset, entry.size, raw, sizeof(State))) return false;
+		if (key == 0) return true;
+		for (size_t i = 0; i < sizeof(State); i++) raw[i] ^= base[i];
+		return true;
+	}
+
+public:
+	// File Access
+	bool open(const char* path) {
+		keyCount = 0;
+		if (!file.open(path) || file.size() < sizeof(Header) + sizeof(Footer)) {
+			printf("\nError: cannot map replay %s\n", path);
+			return false;
+		}
+		memcpy(&header, file.begin(), sizeof(Header));
+		Footer footer;
+		memcpy(&footer, file.begin() + file.size() - sizeof(Footer), sizeof(Footer));
+		if (memcmp(header.magic, "NESR", 4) || header.version != 2 || memcmp(footer.magic, "NESI", 4)) {
+			printf("\nError: %s is not a replay file\n", path);
+			return false;
+		}
+		if (header.stateSize != sizeof(State)) {
+			printf("\nError: %s was written by an incompatible build\n", path);
+			return false;
+		}
+		if (footer.count == 0 || footer.indexOffset + (uint64_t)footer.count * sizeof(IndexEntry) > file.size()) {
+			printf("\nError: %s has a damaged index\n", path);
+			return false;
+		}
+
+		if (sizeof(Header) + (uint64_t)header.pathLength > footer.indexOffset) {
+			printf("\nError: %s has a damaged header\n", path);
+			return false;
+		}
+		std::string romPath((const char*)file.begin() + sizeof(Header), header.pathLength);
+		rom = RomCache::getInstance()->load(romPath.c_str());
+		if (!rom) return false;
+		if (rom->hash != header.romHash) {
+			printf("\nError: %s was recorded from a different %s\n", path, romPath.c_str());
+			return false;
+		}
+
+		input = file.begin() + sizeof(Header) + header.pathLength;
+		index = (const IndexEntry*)(file.begin() + footer.indexOffset);
+		keyCount = footer.count;
+
+		// keyframe 0 is the reference every other keyframe is stored against
+		base.resize(sizeof(State));
+		return decodeKey(0, *(State*)base.data());
+	}
+	static bool write(const char* path, Console* console, Movie& movie, uint32_t interval, const char* romPath) {
+		// romPath is the file the console's ROM was loaded from
+		std::ofstream out(path, std::ios::binary);
+		uint32_t pathLength = (uint32_t)strlen(romPath);
+		Header header = { { 'N', 'E', 'S', 'R' }, 2, movie.portCount(), 0, interval, movie.frameCount(), sizeof(State), pathLength, console->mem->romHash() };
+		out.write((char*)&header, sizeof(Header));
+		out.write(romPath, pathLength);
+		for (uint32_t frame = 0; frame < movie.frameCount(); frame++) {
+			for (int port = 0; port < movie.portCount(); port++) out.put((char)movie.getInput(frame, port));
+		}
+
+		std::unique_ptr<State> baseState(new State());
+		std::unique_ptr<State> state(new State());
+		std::vector<IndexEntry> entries;
+		std::vector<uint8_t> packed;
+		uint64_t offset = sizeof(Header) + pathLength + (uint64_t)movie.frameCount() * movie.portCount();
+		auto addKey = [&](uint32_t frame) {
+			console->saveState(*state);
+			uint8_t* raw = (uint8_t*)state.get();
+			if (entries.empty()) *baseState = *state;
+			else {
+				const uint8_t* ref = (const uint8_t*)baseState.get();
+				for (size_t i = 0; i < sizeof(State); i++) raw[i] ^= ref[i];
+			}
+
+			packed.clear();
+			packRuns(raw, sizeof(State), packed);
+			out.write((char*)packed.data(), packed.size());
+			entries.push_back({ offset, console->hash(), frame, (uint32_t)packed.size() });
+			offset += packed.size();
+		};
+
+		addKey(0);
+		for (uint32_t frame = 0; frame < movie.frameCount(); frame++) {
+			movie.runFrame(console, frame);
+			if ((frame + 1) % interval == 0) addKey(frame + 1);
+		}
+
+		// pad so the index can be read in place from a mapping
+		while (offset % 8) {
+			out.put(0);
+			offset++;
+		}
+		Footer footer = { offset, (uint32_t)entries.size(), { 'N', 'E', 'S', 'I' } };
+		out.write((char*)entries.data(), entries.size() * sizeof(IndexEntry));
+		out.write((char*)&footer, sizeof(Footer));
+		return (bool)out;
+	}
+
+	// Input Stream
+	uint32_t frameCount() {
+		return header.frames;
+	}
+	uint32_t keyframeCount() {
+		return keyCount;
+	}
+	uint8_t getInput(uint32_t frame, int port) {
+		return input[(size_t)frame * header.ports + port];
+	}
+
+	// Seeking
+	// Restores the last keyframe at or before frame, then emulates forward.
+	// Returns false if the keyframe is damaged or frame is past the end.
+	bool seek(Console* console, uint32_t frame) {
+		if (frame > header.frames || keyCount == 0) return false;
+		const IndexEntry* key = std::upper_bound(index, index + keyCount, frame,
+			[](uint32_t target, const IndexEntry& entry) { return target < entry.frame; }) - 1;
+
+		std::unique_ptr<State> state(new State());
+		if (!decodeKey((uint32_t)(key - index), *state)) return false;
+		if (!console->powerOn(rom)) return false;
+		console->loadState(*state);
+		if (console->hash() != key->hash) return false;
+
+		for (uint32_t f = key->frame; f < frame; f++) {
+			console->mem->setInput(0, getInput(f, 0));
+			if (header.ports > 1) console->mem->setInput(1, getInput(f, 1));
+			console->cpu->runFrame();
+		}
+		return true;
+	}
+
+	void test() {
+		std::cout << "\nTesting Replay:";
+
+		// Folds both pads into A, then into RAM, so every frame's state
+		// depends on all the input so far
+		static const uint8_t program[] = {
+			0xA2, 0x01, 0x8E, 0x16, 0x40, 0xA2, 0x00, 0x8E, 0x16, 0x40,	// $8000 strobe $4016
+			0x6D, 0x16, 0x40, 0x2A, 0x6D, 0x17, 0x40, 0x2A,	// ADC $4016; ROL; ADC $4017; ROL
+			0x8D, 0x00, 0x03, 0xEE, 0x01, 0x03,			// STA $0300; INC $0301
+			0x4C, 0x00, 0x80							// JMP $8000
+		};
+		std::vector<uint8_t> image(16 + 0x4000, 0xEA);
+		const uint8_t ines[16] = { 'N', 'E', 'S', 0x1A, 1, 0 };
+		std::copy(ines, ines + 16, image.begin());
+		std::copy(program, program + sizeof(program), image.begin() + 16);
+		image[16 + 0x3FFC] = 0x00;	// reset vector $8000
+		image[16 + 0x3FFD] = 0x80;
+		const char* romPath = "Replay test.nes";
+		const char* path = "Replay test.nesr";
+		std::ofstream(romPath, std::ios::binary).write((const char*)image.data(), image.size());
+
+		// the straight run the replay is written from
+		Movie movie;
+		movie.setPorts(2);
+		for (uint32_t frame = 0; frame < 60; frame++) movie.addFrame((uint8_t)(frame * 0x1D), (uint8_t)(frame / 3));
+		std::vector<uint64_t> expected;
+		Console console;
+		console.powerOn(romPath);
+		for (uint32_t frame = 0; frame < movie.frameCount(); frame++) {
+			expected.push_back(console.stateHash());
+			movie.runFrame(&console, frame);
+		}
+		expected.push_back(console.stateHash());
+		Console recorder;
+		recorder.powerOn(romPath);
+
+		int err_cnt = 0;
+		if (!write(path, &recorder, movie, 10, romPath) || !open(path)) {
+			printf("\nReplay NOT OK: cannot write and open %s\n", path);
+			file.close();
+			std::remove(path);
+			std::remove(romPath);
+			return;
+		}
+		std::cout << "\n  Keyframes: ";{
+			if (keyframeCount() == 7 && frameCount() == 60 && getInput(31, 0) == movie.getInput(31, 0) && getInput(31, 1) == movie.getInput(31, 1)) std::cout << "OK";
+			else {
+				printf("Error: %u keyframes over %u frames", keyframeCount(), frameCount());
+				err_cnt++;
+			}
+		}
+		std::cout << "\n  Seek: ";{
+			// on and between keyframes, backwards as well as forwards
+			static const uint32_t targets[] = { 0, 7, 10, 24, 59, 30, 60, 1 };
+			int wrong = 0;
+			for (uint32_t target : targets) {
+				Console seeker;
+				if (!seek(&seeker, target) || seeker.stateHash() != expected[target]) wrong++;
+				if (!seek(&console, target) || console.stateHash() != expected[target]) wrong++;
+			}
+			if (seek(&console, 61)) wrong++;
+			if (wrong == 0) std::cout << "OK";
+			else {
+				printf("Error: %d seeks differ from the straight run", wrong);
+				err_cnt += wrong;
+			}
+		}
+		file.close();
+		std::remove(path);
+		std::remove(romPath);
+
+		if (err_cnt == 0) std::cout << "\nReplay OK\n";
+		else printf("\nReplay NOT OK: %d errors found\n", err_cnt);
+	}
+};
@@ -0,0 +1,96 @@
+#pragma once
+
+#include <fstream>
+#include <iterator>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include "Hash.h"
+
+// Parsed cartridge image, shared read-only by every instance running it
+struct RomImage {
+	uint64_t hash;				// Content hash of the whole file
+	int mapper;
+	bool vertical;				// Nametable mirroring
+	std::vector<uint8_t> prg;
+	std::vector<uint8_t> chr;	// Empty when the cartridge has CHR RAM
+};
+
+// Process-wide ROM cache keyed by content hash. Images are freed when the
+// last instance using them lets go; loading the same game again while any
+// instance holds it returns the same image.
+class RomCache {
+	// Singleton Class
+	static RomCache* instance;
+	RomCache() {}
+
+private:
+	std::mutex lock;
+	std::map<uint64_t, std::weak_ptr<RomImage>> images;
+
+	static bool parse(const char* path, const std::vector<uint8_t>& file, RomImage& image) {
+		// iNES header
+		if (file.size() < 16 || file[0] != 'N' || file[1] != 'E' || file[2] != 'S' || file[3] != 0x1A) {
+			printf("\nError: %s is not an iNES ROM\n", path);
+			return false;
+		}
+		size_t prgSize = file[4] * 0x4000;
+		size_t chrSize = file[5] * 0x2000;
+		image.mapper = (file[6] >> 4) | (file[7] & 0xF0);
+		image.vertical = file[6] & 0x01;
+		if (image.mapper != 0 || prgSize == 0 || prgSize > 0x8000) {
+			printf("\nError: unsupported mapper %d (%d KB PRG)\n", image.mapper, (int)(prgSize / 0x400));
+			return false;
+		}
+		size_t offset = file[6] & 0x04 ? 16 + 512 : 16; // skip trainer
+		if (file.size() < offset + prgSize + chrSize) {
+			printf("\nError: %s is truncated\n", path);
+			return false;
+		}
+		image.prg.assign(file.begin() + offset, file.begin() + offset + prgSize);
+		image.chr.assign(file.begin() + offset + prgSize, file.begin() + offset + prgSize + chrSize);
+		return true;
+	}
+
+public:
+	// Singleton Class
+	static RomCache* getInstance() {
+		if (!instance) instance = new RomCache;
+		return instance;
+	}
+
+	// Returns the cached image for this file's contents, or null on error
+	std::shared_ptr<const RomImage> load(const char* path) {
+		std::ifstream in(path, std::ios::binary);
+		if (!in) {
+			printf("\nError: cannot open ROM %s\n", path);
+			return nullptr;
+		}
+		std::vector<uint8_t> file((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+		uint64_t hash = hashFinal(hashBytes(file.data(), file.size()));
+
+		std::lock_guard<std::mutex> guard(lock);
+		std::shared_ptr<RomImage> image = images[hash].lock();
+		if (image) return image;
+
+		image = std::make_shared<RomImage>();
+		image->hash = hash;
+		if (!parse(path, file, *image)) return nullptr;
+		images[hash] = image;
+		return image;
+	}
+	size_t imageCount() {
+		// images still held by an instance
+		std::lock_guard<std::mutex> guard(lock);
+		size_t count = 0;
+		for (auto it = images.begin(); it != images.end();) {
+			if (it->second.expired()) it = images.erase(it);
+			else {
+				count++;
+				++it;
+			}
+		}
+		return count;
+	}
+};
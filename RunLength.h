@@ -0,0 +1,48 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+// Run Length Coding
+// control byte n < 128: n + 1 literal bytes follow
+// control byte n >= 128: next byte repeats n - 126 times
+inline void packRuns(const uint8_t* data, size_t len, std::vector<uint8_t>& out) {
+	size_t i = 0;
+	while (i < len) {
+		size_t run = 1;
+		while (i + run < len && run < 129 && data[i + run] == data[i]) run++;
+		if (run >= 2) {
+			out.push_back((uint8_t)(run + 126));
+			out.push_back(data[i]);
+			i += run;
+			continue;
+		}
+
+		// literal run until the next repeat
+		size_t start = i;
+		while (i < len && i - start < 128 && (i + 1 >= len || data[i + 1] != data[i])) i++;
+		out.push_back((uint8_t)(i - start - 1));
+		out.insert(out.end(), data + start, data + i);
+	}
+}
+inline bool unpackRuns(const uint8_t* data, size_t len, uint8_t* out, size_t outLen) {
+	size_t o = 0;
+	for (size_t i = 0; i < len;) {
+		uint8_t control = data[i++];
+		if (control < 128) {
+			size_t count = control + 1;
+			if (i + count > len || o + count > outLen) return false;
+			memcpy(out + o, data + i, count);
+			i += count;
+			o += count;
+		}
+		else {
+			size_t count = control - 126;
+			if (i >= len || o + count > outLen) return false;
+			memset(out + o, data[i++], count);
+			o += count;
+		}
+	}
+	return o == outLen;
+}
@@ -0,0 +1,45 @@
+#pragma once
+
+#include <cstdint>
+#include "Controller.h"
+#include "PPU.h"
+
+// Complete machine state for snapshots and keyframes
+struct State {
+	// CPU Registers
+	uint16_t PC;
+	uint8_t ACC;
+	uint8_t X;
+	uint8_t Y;
+	uint8_t SF;
+	uint8_t SP;
+
+	// CPU Status
+	unsigned int cycle;
+	unsigned int frameEnd;
+	unsigned int frameDots;
+
+	// Memory Regions
+	uint8_t ram[0x0800];
+	uint8_t apu[0x0020];
+	uint8_t crt[0xBFE0];
+	PPU ppu;
+	uint8_t ciram[0x0800];	// Nametables
+	uint8_t palette[0x0020];
+	uint8_t oam[0x0100];	// Sprite memory
+	uint8_t chrRAM[0x2000];	// Pattern tables, zero on CHR ROM carts
+
+	// DMC Sample Fetches
+	uint16_t dmcAddress;
+	uint16_t dmcRemaining;
+	unsigned int dmcNext;
+	uint8_t dmcBuffer;
+	bool dmcIRQ;
+
+	// APU Frame Counter
+	unsigned int frameCounter;
+	bool frameIRQ;
+
+	// Input Devices
+	Controller pad[2];
+};
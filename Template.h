@@ -0,0 +1,147 @@
+#pragma once
+
+#include <cstdio>
+#include <iostream>
+#include <mutex>
+#include "Movie.h"
+
+// Boot Template (.nest)
+//   "NEST", version, boot frame, ROM hash (64 bit), raw State
+// A console booted once to a marked frame (past the power on, logo and title
+// sequence). New instances fork from it instead of powering on: they share
+// every page with the template and copy only what they write.
+class Template {
+private:
+	std::unique_ptr<Console> base;	// Never runs again once booted
+	std::mutex lock;				// fork() remaps the parent's page tables
+	State state;
+	uint32_t frame = 0;				// Frames run before the mark
+
+public:
+	// Template Creation
+	bool boot(const char* romPath, Movie* movie, uint32_t frames) {
+		// runs frames from power on, with the movie's input when given
+		base.reset(new Console);
+		if (!base->powerOn(romPath)) return false;
+		for (frame = 0; frame < frames; frame++) {
+			if (movie && frame < movie->frameCount()) movie->runFrame(base.get(), frame);
+			else base->cpu->runFrame();
+		}
+		base->saveState(state);
+		return true;
+	}
+
+	// File Access
+	bool load(const char* romPath, const char* path) {
+		std::ifstream file(path, std::ios::binary);
+		char magic[5];
+		uint64_t romHash = 0;
+		file.read(magic, 5);
+		file.read((char*)&frame, 4);
+		file.read((char*)&romHash, 8);
+		file.read((char*)&state, sizeof(State));
+		if (!file || magic[0] != 'N' || magic[1] != 'E' || magic[2] != 'S' || magic[3] != 'T' || magic[4] != 1) {
+			printf("\nError: %s is not a boot template\n", path);
+			return false;
+		}
+
+		base.reset(new Console);
+		if (!base->powerOn(romPath)) return false;
+		if (base->mem->romHash() != romHash) {
+			printf("\nError: %s was made from a different ROM\n", path);
+			return false;
+		}
+		base->loadState(state);
+		return true;
+	}
+	bool save(const char* path) {
+		std::ofstream file(path, std::ios::binary);
+		uint64_t romHash = base->mem->romHash();
+		file.write("NEST\1", 5);
+		file.write((char*)&frame, 4);
+		file.write((char*)&romHash, 8);
+		file.write((char*)&state, sizeof(State));
+		return (bool)file;
+	}
+	uint32_t bootFrame() {
+		return frame;
+	}
+
+	// Instances
+	Console* spawn() {
+		// safe to call from several threads
+		std::lock_guard<std::mutex> guard(lock);
+		return base->fork();
+	}
+	void restore(Console* console) {
+		// rewinds a console that runs this ROM back to the mark, keeping
+		// the pages it never wrote shared
+		console->loadState(state);
+	}
+
+	void test() {
+		std::cout << "\nTesting Boot Template:";
+
+		// Folds both pads into A, then into RAM, so every frame's state
+		// depends on all the input so far
+		static const uint8_t program[] = {
+			0xA2, 0x01, 0x8E, 0x16, 0x40, 0xA2, 0x00, 0x8E, 0x16, 0x40,	// $8000 strobe $4016
+			0x6D, 0x16, 0x40, 0x2A, 0x6D, 0x17, 0x40, 0x2A,	// ADC $4016; ROL; ADC $4017; ROL
+			0x8D, 0x00, 0x03, 0xEE, 0x01, 0x03,			// STA $0300; INC $0301
+			0x4C, 0x00, 0x80							// JMP $8000
+		};
+		std::vector<uint8_t> image(16 + 0x4000, 0xEA);
+		const uint8_t ines[16] = { 'N', 'E', 'S', 0x1A, 1, 0 };
+		std::copy(ines, ines + 16, image.begin());
+		std::copy(program, program + sizeof(program), image.begin() + 16);
+		image[16 + 0x3FFC] = 0x00;	// reset vector $8000
+		image[16 + 0x3FFD] = 0x80;
+		const char* romPath = "Boot Template test.nes";
+		const char* path = "Boot Template test.nest";
+		std::ofstream(romPath, std::ios::binary).write((const char*)image.data(), image.size());
+
+		// the straight run, booted to frame 30 and played on to 40
+		const uint32_t mark = 30, end = 40;
+		Movie movie;
+		movie.setPorts(2);
+		for (uint32_t frame = 0; frame < end; frame++) movie.addFrame((uint8_t)(frame * 0x1D), (uint8_t)(frame / 3));
+		Console reference;
+		reference.powerOn(romPath);
+		for (uint32_t frame = 0; frame < mark; frame++) movie.runFrame(&reference, frame);
+		uint64_t atMark = reference.stateHash();
+		for (uint32_t frame = mark; frame < end; frame++) movie.runFrame(&reference, frame);
+		uint64_t atEnd = reference.stateHash();
+
+		int err_cnt = 0;
+		auto check = [&](Template& boot) {
+			// spawn, play on, restore and play on again
+			std::unique_ptr<Console> console(boot.spawn());
+			bool spawned = console->stateHash() == atMark;
+			for (uint32_t frame = mark; frame < end; frame++) movie.runFrame(console.get(), frame);
+			bool played = console->stateHash() == atEnd;
+			boot.restore(console.get());
+			bool restored = console->stateHash() == atMark && console->mem->sharedPages() > 0;
+			for (uint32_t frame = mark; frame < end; frame++) movie.runFrame(console.get(), frame);
+			if (boot.bootFrame() == mark && spawned && played && restored && console->stateHash() == atEnd) std::cout << "OK";
+			else {
+				printf("Error: spawned %d, played %d, restored %d", spawned, played, restored);
+				err_cnt++;
+			}
+		};
+		std::cout << "\n  Spawn and restore: ";{
+			if (boot(romPath, &movie, mark)) check(*this);
+			else err_cnt++;
+		}
+		std::cout << "\n  File: ";{
+			std::unique_ptr<Template> loaded(new Template);
+			if (save(path) && loaded->load(romPath, path)) check(*loaded);
+			else err_cnt++;
+		}
+		base.reset();
+		std::remove(path);
+		std::remove(romPath);
+
+		if (err_cnt == 0) std::cout << "\nBoot Template OK\n";
+		else printf("\nBoot Template NOT OK: %d errors found\n", err_cnt);
+	}
+};
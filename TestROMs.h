@@ -0,0 +1,199 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <sstream>
+#include <thread>
+#include "Console.h"
+
+// Test ROM Suite
+// Runs the standard CPU, PPU, APU and mapper test ROMs headless, several at
+// once, each on its own console. A manifest lists one ROM per line:
+//   <rom> [frames <n>] [screen <hash>]
+// with '#' comments and paths relative to the manifest. ROMs that follow the
+// blargg protocol report through $6000 (status: $80 running, $81 reset
+// wanted, below $80 the result code, 0 passing) once $6001-$6003 hold the
+// DE B0 61 signature, with a message from $6004. Other ROMs (nestest and
+// friends) pass if the screen after the frame limit hashes to the expected
+// value.
+class TestROMs {
+public:
+	enum status {
+		Passed, Failed, TimedOut, LoadError
+	};
+	struct Test {
+		std::string rom;
+		uint32_t frames = 3600;			// Limit, or when the screen is checked
+		uint64_t screen = 0;			// Expected screen hash, 0 for none
+	};
+	struct Result {
+		uint8_t status = LoadError;
+		uint8_t code = 0;				// Result byte from $6000
+		std::string message;
+		uint32_t frames = 0;			// Run before the result was known
+		double seconds = 0;
+		uint64_t screen = 0;			// Screen hash at the end of the run
+	};
+
+private:
+	static const uint32_t ResetDelay = 6;	// Frames between $81 and the reset (~100ms)
+
+	std::vector<Test> tests;
+
+	static bool reporting(MemMap* mem) {
+		return mem->read(0x6001) == 0xDE && mem->read(0x6002) == 0xB0 && mem->read(0x6003) == 0x61;
+	}
+	static std::string message(MemMap* mem) {
+		std::string text;
+		for (uint16_t addr = 0x6004; addr < 0x7000; addr++) {
+			char c = (char)mem->read(addr);
+			if (!c) break;
+			text += c;
+		}
+		return text;
+	}
+	static uint64_t screenHash(Console& console) {
+		std::unique_ptr<Frame> frame(new Frame());
+		console.renderFrame(*frame);
+		return hashFinal(hashBytes(&frame->pixels[0][0], sizeof(frame->pixels)));
+	}
+	static Result run(const Test& test) {
+		Result result;
+		auto start = std::chrono::high_resolution_clock::now();
+		Console console;
+		if (!console.powerOn(test.rom.c_str())) return result;
+		result.status = TimedOut;
+		play(console, test, result);
+		result.seconds = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
+		return result;
+	}
+	static void play(Console& console, const Test& test, Result& result) {
+		uint32_t resetAt = 0;
+		while (result.frames < test.frames) {
+			console.cpu->runFrame();
+			result.frames++;
+			if (!reporting(console.mem)) continue;
+			uint8_t code = console.mem->read(0x6000);
+			if (code == 0x81) {
+				// the ROM wants the reset button pressed
+				if (!resetAt) resetAt = result.frames + ResetDelay;
+				else if (result.frames >= resetAt) {
+					console.cpu->softReset();
+					resetAt = 0;
+				}
+			}
+			else if (code < 0x80) {
+				result.code = code;
+				result.status = code ? Failed : Passed;
+				result.message = message(console.mem);
+				break;
+			}
+		}
+
+		result.screen = screenHash(console);
+		if (result.status == TimedOut && test.screen) result.status = result.screen == test.screen ? Passed : Failed;
+	}
+
+public:
+	// Manifest
+	bool load(const char* path) {
+		std::ifstream file(path);
+		if (!file) {
+			printf("\nError: cannot open %s\n", path);
+			return false;
+		}
+		std::string dir(path);
+		size_t slash = dir.find_last_of("/\\");
+		dir = slash == std::string::npos ? "" : dir.substr(0, slash + 1);
+
+		std::string line;
+		for (int number = 1; std::getline(file, line); number++) {
+			line = line.substr(0, line.find('#'));
+			std::istringstream words(line);
+			Test test;
+			if (!(words >> test.rom)) continue;
+			if (test.rom[0] != '/' && test.rom[0] != '\\') test.rom = dir + test.rom;
+			std::string key;
+			while (words >> key) {
+				if (key == "frames" && words >> test.frames) continue;
+				if (key == "screen" && words >> std::hex >> test.screen >> std::dec) continue;
+				printf("\nError: %s line %d: bad option %s\n", path, number, key.c_str());
+				return false;
+			}
+			tests.push_back(test);
+		}
+		return true;
+	}
+	size_t count() {
+		return tests.size();
+	}
+	const Test& test(size_t index) {
+		return tests[index];
+	}
+
+	// Running
+	// One test per thread at a time; results come back in manifest order.
+	std::vector<Result> runAll(unsigned int threads = 0) {
+		if (threads == 0) threads = std::thread::hardware_concurrency();
+		if (threads == 0) threads = 1;
+
+		std::vector<Result> results(tests.size());
+		std::atomic<size_t> next(0);
+		auto worker = [&]() {
+			for (size_t i = next++; i < tests.size(); i = next++) results[i] = run(tests[i]);
+		};
+
+		std::vector<std::thread> pool;
+		for (unsigned int i = 0; i < threads; i++) pool.emplace_back(worker);
+		for (std::thread& thread : pool) thread.join();
+		return results;
+	}
+
+	void test() {
+		std::cout << "\nTesting Test ROMs:";
+
+		// First boot asks for a reset, acknowledging frame IRQs while it
+		// waits; after it, keeps SP in $6104 and passes from the frame IRQ
+		// handler, which only comes in time if the sequence kept running
+		static const uint8_t program[] = {
+			0x78, 0xAE, 0x00, 0x61, 0xD0, 0x1F,			// $8000 SEI; LDX $6100; BNE $8025
+			0xA2, 0x01, 0x8E, 0x00, 0x61,				// LDX #1; STX $6100
+			0xA2, 0xDE, 0x8E, 0x01, 0x60, 0xA2, 0xB0, 0x8E, 0x02, 0x60, 0xA2, 0x61, 0x8E, 0x03, 0x60,
+			0xA2, 0x81, 0x8E, 0x00, 0x60,				// status $81
+			0xAE, 0x15, 0x40, 0x4C, 0x1F, 0x80,			// $801F LDX $4015; JMP $801F
+			0xBA, 0x8E, 0x04, 0x61,						// $8025 TSX; STX $6104
+			0xA2, 0x80, 0x8E, 0x00, 0x60,				// status $80
+			0x58, 0x4C, 0x2F, 0x80,						// CLI; JMP *
+			0xAE, 0x15, 0x40, 0xA2, 0x00, 0x8E, 0x00, 0x60, 0x40	// $8032 IRQ: LDX $4015; status 0; RTI
+		};
+		std::shared_ptr<RomImage> image = std::make_shared<RomImage>();
+		image->mapper = 0;
+		image->vertical = false;
+		image->prg.assign(0x4000, 0xEA);
+		std::copy(program, program + sizeof(program), image->prg.begin());
+		image->prg[0x3FFA] = 0x3A;	// NMI: RTI
+		image->prg[0x3FFB] = 0x80;
+		image->prg[0x3FFC] = 0x00;	// reset
+		image->prg[0x3FFD] = 0x80;
+		image->prg[0x3FFE] = 0x32;	// IRQ
+		image->prg[0x3FFF] = 0x80;
+		image->hash = hashFinal(hashBytes(image->prg.data(), image->prg.size()));
+
+		int err_cnt = 0;
+		Console console;
+		Test reset;
+		Result result;
+		reset.frames = 60;
+		console.powerOn(image);
+		result.status = TimedOut;
+		play(console, reset, result);
+		// power on leaves SP at $FD; the reset takes 3 more
+		if (result.status != Passed || result.frames > ResetDelay + 3 || console.mem->read(0x6104) != 0xFA) {
+			printf("\n  Reset: status %d, code %d, SP %02x after %u frames", result.status, result.code, console.mem->read(0x6104), result.frames);
+			err_cnt++;
+		}
+
+		if (err_cnt == 0) std::cout << "\nTest ROMs OK\n";
+		else printf("\nTest ROMs NOT OK: %d errors found\n", err_cnt);
+	}
+};
@@ -0,0 +1,143 @@
+#pragma once
+
+#include <emmintrin.h>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include "PPU.h"
+
+// Frame Conversion
+// Frames stay palette-indexed until a consumer asks for pixels. Conversion
+// looks up two pixels at a time in tables of every colour pair, built for
+// the frame's emphasis bits: SSE2 has no byte shuffle to look colours up
+// in-register, so it forms the pair indices 16 pixels at a time instead.
+class Video {
+public:
+	enum format {
+		RGBA, RGB565, YUYV
+	};
+
+private:
+	// 2C02 colours, 0xRRGGBB
+	static const uint32_t* colours() {
+		static const uint32_t table[64] = {
+			0x545454, 0x001E74, 0x081090, 0x300088, 0x440064, 0x5C0030, 0x540400, 0x3C1800,
+			0x202A00, 0x083A00, 0x004000, 0x003C00, 0x00323C, 0x000000, 0x000000, 0x000000,
+			0x989698, 0x084CC4, 0x3032EC, 0x5C1EE4, 0x8814B0, 0xA01464, 0x982220, 0x783C00,
+			0x545A00, 0x287200, 0x087C00, 0x007628, 0x006678, 0x000000, 0x000000, 0x000000,
+			0xECEEEC, 0x4C9AEC, 0x787CEC, 0xB062EC, 0xE454EC, 0xEC58B4, 0xEC6A64, 0xD48820,
+			0xA0AA00, 0x74C400, 0x4CD020, 0x38CC6C, 0x38B4CC, 0x3C3C3C, 0x000000, 0x000000,
+			0xECEEEC, 0xA8CCEC, 0xBCBCEC, 0xD4B2EC, 0xECAEEC, 0xECAED4, 0xECB4B0, 0xE4C490,
+			0xCCD278, 0xB4DE78, 0xA8E290, 0x98E2B4, 0xA0D6E4, 0xA0A2A0, 0x000000, 0x000000
+		};
+		return table;
+	}
+
+	// Pair Tables
+	// index = first pixel | second pixel << 6
+	uint64_t rgbaPair[64 * 64];
+	uint32_t rgb565Pair[64 * 64];
+	uint32_t yuyvPair[64 * 64];
+	int emphasis = -1;	// Emphasis the tables were built for
+
+	void rgb(int colour, int bits, int& r, int& g, int& b) {
+		// emphasis dims the two colours not selected
+		uint32_t value = colours()[colour];
+		r = value >> 16;
+		g = (value >> 8) & 0xFF;
+		b = value & 0xFF;
+		if (bits & 0x01) { g = g * 13 / 16; b = b * 13 / 16; }
+		if (bits & 0x02) { r = r * 13 / 16; b = b * 13 / 16; }
+		if (bits & 0x04) { r = r * 13 / 16; g = g * 13 / 16; }
+	}
+	void build(int bits) {
+		uint32_t rgba[64], rgb565[64];
+		int y[64], u[64], v[64];
+		for (int c = 0; c < 64; c++) {
+			int r, g, b;
+			rgb(c, bits, r, g, b);
+			rgba[c] = r | (g << 8) | (b << 16) | 0xFF000000;
+			rgb565[c] = ((r >> 3) << 11) | ((g >> 2) << 5) | (b >> 3);
+
+			// BT.601 studio range
+			y[c] = (66 * r + 129 * g + 25 * b + 128) / 256 + 16;
+			u[c] = (-38 * r - 74 * g + 112 * b + 128) / 256 + 128;
+			v[c] = (112 * r - 94 * g - 18 * b + 128) / 256 + 128;
+		}
+		for (int second = 0; second < 64; second++) {
+			for (int first = 0; first < 64; first++) {
+				int pair = first | (second << 6);
+				rgbaPair[pair] = rgba[first] | ((uint64_t)rgba[second] << 32);
+				rgb565Pair[pair] = rgb565[first] | (rgb565[second] << 16);
+				yuyvPair[pair] = y[first] | (((u[first] + u[second]) / 2) << 8) | (y[second] << 16) | ((uint32_t)((v[first] + v[second]) / 2) << 24);
+			}
+		}
+		emphasis = bits;
+	}
+	template <typename T, typename Out>
+	void convert(const Frame& frame, const T* table, Out* out) {
+		// Out is written as T per pixel pair
+		if (frame.emphasis != emphasis) build(frame.emphasis);
+		const uint8_t* pixels = &frame.pixels[0][0];
+		const __m128i colour = _mm_set1_epi8(0x3F);
+		const __m128i low = _mm_set1_epi16(0x00FF);
+		uint16_t pair[8];
+		for (int i = 0; i < Frame::Width * Frame::Height; i += 16) {
+			__m128i p = _mm_and_si128(_mm_loadu_si128((const __m128i*)(pixels + i)), colour);
+			__m128i index = _mm_or_si128(_mm_and_si128(p, low), _mm_slli_epi16(_mm_srli_epi16(p, 8), 6));
+			_mm_storeu_si128((__m128i*)pair, index);
+			for (int k = 0; k < 8; k++) memcpy(out + i + k * 2, &table[pair[k]], sizeof(T));
+		}
+	}
+
+public:
+	// Frame Conversion
+	void toRGBA(const Frame& frame, uint32_t* out) {
+		// 4 bytes per pixel: R, G, B, A
+		convert(frame, rgbaPair, out);
+	}
+	void toRGB565(const Frame& frame, uint16_t* out) {
+		convert(frame, rgb565Pair, out);
+	}
+	void toYUYV(const Frame& frame, uint8_t* out) {
+		// packed 4:2:2, 2 bytes per pixel; each pair shares U and V
+		convert(frame, yuyvPair, (uint16_t*)out);
+	}
+	void toFormat(const Frame& frame, int format, void* out) {
+		if (format == RGBA) toRGBA(frame, (uint32_t*)out);
+		else if (format == RGB565) toRGB565(frame, (uint16_t*)out);
+		else toYUYV(frame, (uint8_t*)out);
+	}
+
+	// Emulator Utilities
+	void test() {
+		std::cout << "\nTesting Video:";
+
+		int err_cnt = 0;
+		Frame* frame = new Frame();
+		for (int i = 0; i < Frame::Width * Frame::Height; i++) (&frame->pixels[0][0])[i] = (uint8_t)(i * 7 + i / 251);
+		uint32_t* rgba = new uint32_t[Frame::Width * Frame::Height];
+		uint16_t* rgb565 = new uint16_t[Frame::Width * Frame::Height];
+		for (int bits = 0; bits < 8; bits += 5) {
+			frame->emphasis = bits;
+			toRGBA(*frame, rgba);
+			toRGB565(*frame, rgb565);
+			for (int i = 0; i < Frame::Width * Frame::Height; i++) {
+				int r, g, b;
+				rgb((&frame->pixels[0][0])[i] & 0x3F, bits, r, g, b);
+				uint32_t expected = r | (g << 8) | (b << 16) | 0xFF000000;
+				if (rgba[i] != expected || rgb565[i] != (((r >> 3) << 11) | ((g >> 2) << 5) | (b >> 3))) {
+					printf("\nPixel %d emphasis %d: expected %08x, got %08x", i, bits, expected, rgba[i]);
+					err_cnt++;
+					break;
+				}
+			}
+		}
+		delete[] rgb565;
+		delete[] rgba;
+		delete frame;
+
+		if (err_cnt == 0) std::cout << "\nVideo OK\n";
+		else printf("\nVideo NOT OK: %d errors found\n", err_cnt);
+	}
+};